@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+
+#include <mstd/range.hpp>
+
+namespace Modbus {
+
+// Longitudinal redundancy check, as used by Modbus ASCII.
+// Adding the check value itself to the sum makes get() return zero.
+class lrc {
+	unsigned char sum_ = 0;
+
+public:
+	lrc() {}
+	explicit lrc(mstd::range<unsigned char const> r) { add(r); }
+
+	lrc & add(mstd::range<unsigned char const> r) {
+		for (unsigned char b : r) sum_ += b;
+		return *this;
+	}
+
+	unsigned char get() const { return -sum_; }
+
+	operator unsigned char() const { return get(); }
+};
+
+// Encode the bytes as upper case hexadecimal digits.
+// Writes exactly 2 * in.size() characters, and returns the end of the output.
+char * hex_encode(mstd::range<unsigned char const> in, char * out);
+
+// Decode hexadecimal digits (upper or lower case) into in.size() / 2 bytes.
+// Returns false if in.size() is odd or if in contains a non-hex character.
+bool hex_decode(mstd::range<char const> in, unsigned char * out);
+
+}
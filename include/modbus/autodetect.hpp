@@ -0,0 +1,73 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <mstd/error_or.hpp>
+#include <mstd/range.hpp>
+
+#include "modbus.hpp"
+#include "serial.hpp"
+#include "serial_rtu.hpp"
+
+namespace Modbus {
+
+// Likely serial settings of an RTU line, most likely first: the Modbus
+// default of 19200 8E1, then 9600 and the other common baud rates, each
+// with even, no and odd parity, and finally no parity with two stop bits.
+std::vector<SerialSettings> likely_serial_settings();
+
+struct autodetect_options {
+	// The slaves to send the probes to. One that is known to exist makes the
+	// detection fastest.
+	std::vector<byte_t> slave_ids{1};
+
+	std::vector<SerialSettings> candidates = likely_serial_settings();
+
+	// The time a slave needs to respond. The timeout of every probe is the
+	// time to transmit it at the candidate baud rate, t3.5, and this.
+	std::chrono::milliseconds processing{20};
+
+	// The number of probes (to different addresses) that must get a valid
+	// response before settings are accepted. With a wrong parity setting,
+	// a single frame might still get through intact.
+	unsigned int confirmations = 2;
+};
+
+// The settings of a line, as found by autodetect().
+struct line_config {
+	std::string port;
+	SerialSettings settings;
+	byte_t slave_id = 0; // The slave that answered.
+};
+
+// Find the serial settings of a line, by reconfiguring the port to every
+// candidate in turn, and sending a small read to the slaves. Settings are
+// only accepted on responses with a valid CRC (including exception
+// responses). On success, the bus is left configured with the detected
+// settings. Returns Error::timeout if no candidate worked.
+error_or<line_config> autodetect(ModbusSerialRtu & bus, autodetect_options const & options = {});
+
+// Open every port and run autodetect() on it. All ports are detected in
+// parallel, each in its own thread.
+std::vector<error_or<line_config>> autodetect_ports(
+	range<std::string const> ports,
+	autodetect_options const & options = {}
+);
+
+// Save line configurations to a small text file, one line per port, such
+// that the detection can be skipped next time.
+error_or<void> save_line_configs(char const * file_name, range<line_config const> lines);
+
+error_or<std::vector<line_config>> load_line_configs(char const * file_name);
+
+// The serial settings formatted as on the command line of the tool (e.g.
+// "19200E1"), and parsed back. Only eight data bits are supported. When
+// parsing, the parity defaults to E and the stop bits to 1, as in the Modbus
+// default.
+std::string format_serial_settings(SerialSettings const & settings);
+
+error_or<SerialSettings> parse_serial_settings(char const * s);
+
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <mstd/error_or.hpp>
+#include <mstd/range.hpp>
+
+#include "modbus.hpp"
+
+namespace Modbus {
+
+// A list of mixed requests, possibly to different slaves, that is run at
+// once:
+//
+//     Batch batch;
+//     auto temp = batch.read_input_registers(1, 0x100, 4);
+//     auto alarms = batch.read_coils(2, 0, 16);
+//     batch.mask_write_register(3, 7, 0xFFFE, 0x0001);
+//     batch.run(bus, 100ms);
+//     if (batch.result(temp)) use(batch.values(temp));
+//
+// The register and coil values of all requests (written and read) live in
+// one arena, and the outcomes in one array. Both keep their capacity on
+// clear(), and run() allocates nothing, so a batch that is run every cycle
+// (or rebuilt every cycle with the same shape) does not allocate.
+//
+// Coils are stored as one uint16_t (0 or 1) each.
+class Batch {
+
+public:
+	// Index of a request, as returned when it is added.
+	using item_t = std::size_t;
+
+	// Function code 0x01, 0x02, 0x03 and 0x04.
+	item_t read_coils(byte_t slave_id, uint16_t address, uint16_t count) { return add(slave_id, 0x01, address, count, 0, 0); }
+	item_t read_inputs(byte_t slave_id, uint16_t address, uint16_t count) { return add(slave_id, 0x02, address, count, 0, 0); }
+	item_t read_holding_registers(byte_t slave_id, uint16_t address, uint16_t count) { return add(slave_id, 0x03, address, count, 0, 0); }
+	item_t read_input_registers(byte_t slave_id, uint16_t address, uint16_t count) { return add(slave_id, 0x04, address, count, 0, 0); }
+
+	// Function code 0x05 or 0x0F. The values are copied into the batch, and
+	// can be changed later through values().
+	item_t write_coils(byte_t slave_id, uint16_t address, range<bool const> values);
+	item_t write_coils(byte_t slave_id, uint16_t address, range<uint16_t const> values);
+
+	// Function code 0x06 or 0x10.
+	item_t write_registers(byte_t slave_id, uint16_t address, range<uint16_t const> values);
+
+	// Function code 0x16.
+	item_t mask_write_register(byte_t slave_id, uint16_t address, uint16_t and_mask, uint16_t or_mask);
+
+	// Function code 0x17. values() gives the registers read, and
+	// write_values() the registers written.
+	item_t read_write_registers(
+		byte_t slave_id,
+		uint16_t write_address,
+		range<uint16_t const> write_values,
+		uint16_t read_address,
+		uint16_t read_count
+	);
+
+	// Run all requests, in the order they were added.
+	//
+	// Transports in this library run one transaction at a time, and
+	// ModbusSerial already keeps only the turnaround delay between them, so
+	// the requests are sent back to back. When skip_after_timeout is set, the
+	// remaining requests to a slave that timed out are not sent (and result
+	// in Error::timeout), instead of each waiting for the full timeout.
+	//
+	// A write_registers followed directly by a read_holding_registers of the
+	// same slave are sent together as a single read_write_registers (0x17)
+	// transaction, saving a round trip. Both get the outcome of that
+	// transaction.
+	//
+	// Writes to slave id 0 are broadcast, and succeed once sent.
+	//
+	// Returns the first error, if any. All outcomes are in results().
+	error_or<void> run(Modbus & bus, Modbus::timeout_t timeout, bool skip_after_timeout = true);
+
+	std::size_t size() const { return items_.size(); }
+
+	bool empty() const { return items_.empty(); }
+
+	// The outcome of every request of the last run(), in order. Requests
+	// that were not run yet have Error::timeout.
+	range<error_or<void> const> results() const { return results_; }
+
+	error_or<void> const & result(item_t i) const { return results_[i]; }
+
+	// The values read, or for writes, the values written.
+	range<uint16_t> values(item_t i) {
+		auto const & t = items_[i];
+		return {values_.data() + t.offset, t.count};
+	}
+	range<uint16_t const> values(item_t i) const {
+		auto const & t = items_[i];
+		return {values_.data() + t.offset, t.count};
+	}
+
+	// For read_write_registers, the values written.
+	range<uint16_t> write_values(item_t i) {
+		auto const & t = items_[i];
+		return {values_.data() + t.offset + t.count, t.write_count};
+	}
+
+	// By default, read_write_registers is assumed to be supported until the
+	// slave responds with Error::illegal_function.
+	void set_read_write_supported(byte_t slave_id, bool supported) {
+		no_read_write_[slave_id] = !supported;
+	}
+
+	// Remove all requests, but keep the memory for reuse.
+	void clear();
+
+	// Reserve memory for the given number of requests and values.
+	void reserve(std::size_t items, std::size_t values);
+
+private:
+	struct item {
+		byte_t slave_id;
+		byte_t function_code;
+		uint16_t address;
+		uint16_t count;
+		// For 0x17: the write address and count. For 0x16: the masks.
+		uint16_t write_address;
+		uint16_t write_count;
+		std::size_t offset; // In values_.
+	};
+
+	std::vector<item> items_;
+	std::vector<uint16_t> values_;
+	std::vector<error_or<void>> results_;
+	std::bitset<256> no_read_write_;
+
+	item_t add(byte_t slave_id, byte_t function_code, uint16_t address, uint16_t count, uint16_t write_address, uint16_t write_count);
+
+	error_or<void> run(Modbus & bus, item const & t, Modbus::timeout_t timeout);
+
+	// Whether items i and i + 1 can be sent as one read_write_registers.
+	bool fusable(std::size_t i) const;
+
+};
+
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <system_error>
+#include <vector>
+
+#include <mstd/error_or.hpp>
+#include <mstd/range.hpp>
+
+#include "modbus.hpp"
+
+namespace Modbus {
+
+// Write the same values to many slaves with a single broadcast, then read
+// them back from every slave, one after the other. Slaves that return
+// different values are written to directly (function code 0x06 or 0x10)
+// instead.
+//
+// Returns the outcome for every slave, in the same order as slave_ids.
+// On a serial bus, the broadcast delay (see ModbusSerial::broadcast_delay)
+// is waited for before the first read.
+std::vector<std::error_code> broadcast_registers(
+	Modbus & bus,
+	range<byte_t const> slave_ids,
+	uint16_t address,
+	range<uint16_t const> values,
+	Modbus::timeout_t timeout
+);
+
+// Same, for coils (function code 0x05 or 0x0F, read back with 0x01).
+std::vector<std::error_code> broadcast_coils(
+	Modbus & bus,
+	range<byte_t const> slave_ids,
+	uint16_t address,
+	range<bool const> values,
+	Modbus::timeout_t timeout
+);
+
+}
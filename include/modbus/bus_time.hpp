@@ -0,0 +1,158 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include <mstd/range.hpp>
+
+#include "modbus.hpp"
+#include "serial.hpp"
+
+namespace Modbus {
+
+// A transaction in a poll configuration.
+struct planned_transaction {
+	byte_t slave_id;
+	byte_t function_code;
+	// Number of coils or registers read or written. For 0x17, the number
+	// read. For 0x18, the expected number of queued registers.
+	uint16_t count = 1;
+	// Number of registers written by 0x17.
+	uint16_t write_count = 0;
+	// Frame sizes on the wire, for function codes not listed above (e.g.
+	// file records). Zero means derived from the function code and count.
+	std::size_t request_size = 0;
+	std::size_t response_size = 0;
+	// The time the slave needs to respond. Negative means the default of
+	// the model.
+	std::chrono::microseconds processing{-1};
+};
+
+// Frame sizes on the wire of a transaction.
+struct wire_sizes {
+	std::size_t request;
+	std::size_t response; // Zero for a broadcast.
+};
+
+// With RTU framing, including slave id and crc. ASCII frames are twice that
+// (the bytes in hex, with an LRC instead of the crc) plus ':', CR and LF.
+// The sizes given in the transaction are taken as they are.
+wire_sizes frame_sizes(planned_transaction const & t, Framing framing = Framing::rtu);
+
+// Where the time of a transaction goes.
+struct transaction_time {
+	std::chrono::microseconds request{0};    // Transmitting the request.
+	std::chrono::microseconds processing{0}; // Until the slave responds.
+	std::chrono::microseconds response{0};   // Transmitting the response.
+	std::chrono::microseconds frame_end{0};  // The silence that ends an RTU response (t3.5).
+	// The delay before the next transaction: the turnaround delay, or the
+	// broadcast delay.
+	std::chrono::microseconds turnaround{0};
+
+	std::chrono::microseconds wire() const { return request + response; }
+
+	// As measured by transaction_info::duration.
+	std::chrono::microseconds transaction() const { return request + processing + response + frame_end; }
+
+	std::chrono::microseconds total() const { return transaction() + turnaround; }
+};
+
+// Predicts the bus time of transactions on a serial line, from the serial
+// settings, the framing, and the frame sizes of every function code.
+class BusTimeModel {
+
+	SerialSettings settings_;
+	Framing framing_;
+	std::chrono::microseconds processing_;
+	std::chrono::microseconds turnaround_;
+	std::chrono::microseconds broadcast_delay_;
+
+public:
+	// processing is the default time slaves need to respond. The turnaround
+	// delay defaults to t3.5, as in ModbusSerial.
+	explicit BusTimeModel(
+		SerialSettings settings,
+		Framing framing = Framing::rtu,
+		std::chrono::microseconds processing = std::chrono::milliseconds(1),
+		std::chrono::microseconds turnaround = std::chrono::microseconds(-1),
+		std::chrono::microseconds broadcast_delay = std::chrono::milliseconds(100)
+	);
+
+	// With the settings and delays of a bus.
+	explicit BusTimeModel(ModbusSerial const & bus, std::chrono::microseconds processing = std::chrono::milliseconds(1));
+
+	SerialSettings const & settings() const { return settings_; }
+
+	Framing framing() const { return framing_; }
+
+	std::chrono::microseconds default_processing() const { return processing_; }
+
+	transaction_time predict(planned_transaction const & t) const;
+
+	// The bus time of a single transaction, given its actual frame sizes.
+	transaction_time predict(byte_t slave_id, std::size_t request_size, std::size_t response_size, std::chrono::microseconds processing) const;
+
+	// The shortest possible period to run all transactions once.
+	std::chrono::microseconds min_scan_period(range<planned_transaction const> plan) const;
+
+	// Fraction of the line time used when running all transactions once
+	// every period. Above 1, the line is oversubscribed. 0 if the period is
+	// not positive.
+	double utilization(range<planned_transaction const> plan, std::chrono::microseconds period) const;
+
+};
+
+// Compares measured transactions (from ModbusSerial's transaction hook)
+// with the predictions of a BusTimeModel, per slave.
+//
+//     bus.set_transaction_hook([&] (transaction_info const & i) { monitor.add(i); });
+class BusTimeMonitor {
+
+public:
+	struct slave_report {
+		byte_t slave_id;
+		unsigned int transactions;
+		unsigned int errors; // Including timeouts.
+		std::chrono::microseconds mean_duration;  // Measured, of answered transactions.
+		std::chrono::microseconds mean_predicted; // For the same frame sizes.
+		// Measured time until the first response byte, minus the time to
+		// transmit the request (and read back a local echo). Compare with
+		// the model's processing time.
+		std::chrono::microseconds mean_processing;
+	};
+
+private:
+	struct slave_stats {
+		unsigned int transactions = 0;
+		unsigned int errors = 0;
+		unsigned int answered = 0;
+		std::chrono::microseconds duration{0};
+		std::chrono::microseconds predicted{0};
+		std::chrono::microseconds processing{0};
+	};
+
+	BusTimeModel model_;
+	std::map<byte_t, slave_stats> slaves_;
+	std::chrono::steady_clock::time_point first_start_;
+	std::chrono::steady_clock::time_point last_end_;
+	std::chrono::steady_clock::duration busy_{0};
+
+public:
+	explicit BusTimeMonitor(BusTimeModel model) : model_(model) {}
+
+	void add(transaction_info const & info);
+
+	std::vector<slave_report> report() const;
+
+	// Fraction of the time between the start of the first and the end of
+	// the last transaction that the line was busy.
+	double utilization() const;
+
+	void clear();
+
+};
+
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <chrono>
+#include <system_error>
+
+#include <mstd/error_or.hpp>
+#include <mstd/range.hpp>
+
+#include "modbus.hpp"
+#include "scan.hpp"
+
+namespace Modbus {
+
+// What is known about every slave on a bus, kept across restarts.
+//
+// Filled by probe() results and by the outcome of normal requests (see
+// ModbusCapabilityGuard), and saved to a small binary file. The scan
+// command of the tool writes such a file.
+class CapabilityCache {
+
+	std::array<DeviceProfile, 256> profiles_;
+	std::bitset<256> known_;
+	bool changed_ = false;
+
+public:
+	CapabilityCache() {
+		for (unsigned int i = 0; i < profiles_.size(); ++i) profiles_[i].slave_id = i;
+	}
+
+	// The profile of a slave, or nullptr if nothing is known about it.
+	DeviceProfile const * find(byte_t slave_id) const {
+		return known_[slave_id] ? &profiles_[slave_id] : nullptr;
+	}
+
+	// Replace everything known about a slave.
+	void set(DeviceProfile const & profile);
+
+	// Forget everything known about a slave.
+	void erase(byte_t slave_id);
+
+	// Whether anything changed since the last load() or save().
+	bool changed() const { return changed_; }
+
+	// Error::illegal_function if the function code is known to be
+	// unsupported, or Error::request_too_large if more items are requested
+	// than the slave is known to handle. Otherwise, no error.
+	std::error_code check(byte_t slave_id, byte_t function_code, range<byte_t const> parameters) const;
+
+	// Learn from the outcome of a request.
+	//
+	// Error::illegal_function marks the function code as unsupported, any
+	// other response as supported. Error::illegal_data_value on a read
+	// lowers the maximum read size below the requested quantity, as that is
+	// the exception for a quantity out of range. (Error::illegal_data_address
+	// depends on the address, so is not taken as a size limit.)
+	// The latency of successful transactions is averaged.
+	void learn(
+		byte_t slave_id,
+		byte_t function_code,
+		range<byte_t const> parameters,
+		std::error_code result,
+		std::chrono::microseconds latency
+	);
+
+	// Record whether the line to a slave echoes requests, e.g. as found by
+	// ModbusSerialRtu::detect_echo().
+	void set_echo(byte_t slave_id, DeviceProfile::Echo echo);
+
+	// The file is a fixed header followed by a fixed size record for every
+	// known slave, in little endian byte order.
+	error_or<void> load(char const * file_name);
+	error_or<void> save(char const * file_name);
+
+};
+
+// A bus that checks every request against a CapabilityCache before sending
+// it, and updates the cache with the outcome.
+//
+// Requests that are known to fail return their error immediately, without
+// any traffic on the bus.
+class ModbusCapabilityGuard final : public Modbus {
+
+	Modbus & bus_;
+	CapabilityCache & cache_;
+
+public:
+	ModbusCapabilityGuard(Modbus & bus, CapabilityCache & cache)
+		: bus_(bus), cache_(cache) {}
+
+	Modbus & bus() { return bus_; }
+
+	CapabilityCache & cache() { return cache_; }
+
+	error_or<range<byte_t>> raw_command(
+		byte_t slave_id,
+		byte_t function_code,
+		range<byte_t const> parameters,
+		range<byte_t> response_buffer,
+		timeout_t timeout
+	) override;
+
+};
+
+}
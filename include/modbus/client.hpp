@@ -0,0 +1,544 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include <mstd/error_or.hpp>
+#include <mstd/range.hpp>
+
+#include "error.hpp"
+#include "modbus.hpp"
+
+namespace Modbus {
+
+// The function code helpers, for any transport type with a raw_command()
+// like Modbus::raw_command().
+//
+// With a concrete (final, or non-virtual) transport type, the call to
+// raw_command() is resolved at compile time, instead of through the vtable.
+// Whether the transport itself is inlined depends on it: ModbusRtuSocket and
+// ModbusSerial implement raw_command() out of line, and ModbusSerial then
+// calls the framing (serial_command()) virtually. So for the transports in
+// this library, only the outer call is devirtualized.
+//
+// Every function that takes a range also has an overload taking a
+// std::array. Those check the size at compile time, and use buffers of
+// exactly the right size.
+//
+// Nothing is allocated on the heap. Class Modbus forwards all its functions
+// to a Client<Modbus>.
+template<typename Transport>
+class Client {
+
+public:
+	using timeout_t = Modbus::timeout_t;
+
+private:
+	Transport & transport_;
+
+	static constexpr std::size_t bits_response_size(std::size_t n) { return (n + 7) / 8 + 1; }
+	static constexpr std::size_t regs_response_size(std::size_t n) { return n * 2 + 1; }
+
+	template<std::size_t BufferSize, typename T>
+	error_or<void> read_bits(
+		byte_t function_code,
+		byte_t slave_id,
+		uint16_t address,
+		range<T> values,
+		std::size_t n,
+		timeout_t timeout
+	) {
+		std::array<byte_t, std::max<std::size_t>(BufferSize, 4)> buffer;
+		byte_t * p = buffer.data();
+		*p++ = address >> 8;
+		*p++ = address & 0xFF;
+		*p++ = n >> 8;
+		*p++ = n & 0xFF;
+		std::size_t n_expected_bytes = bits_response_size(n);
+		if (auto r = transport_.raw_command(slave_id, function_code, {buffer.data(), p}, {buffer.data(), n_expected_bytes}, timeout)) {
+			if (r->size() != n_expected_bytes || buffer[0] != n_expected_bytes - 1) {
+				return std::error_code(Error::invalid_response);
+			}
+			for (std::size_t i = 0; i < n; ++i) {
+				values[i] = buffer[1 + i / 8] >> i % 8 & 1;
+			}
+			return {};
+		} else {
+			return r.error();
+		}
+	}
+
+	template<std::size_t BufferSize>
+	error_or<void> read_regs(
+		byte_t function_code,
+		byte_t slave_id,
+		uint16_t address,
+		range<uint16_t> values,
+		std::size_t n,
+		timeout_t timeout
+	) {
+		std::array<byte_t, std::max<std::size_t>(BufferSize, 4)> buffer;
+		byte_t * p = buffer.data();
+		*p++ = address >> 8;
+		*p++ = address & 0xFF;
+		*p++ = n >> 8;
+		*p++ = n & 0xFF;
+		std::size_t n_expected_bytes = regs_response_size(n);
+		if (auto r = transport_.raw_command(slave_id, function_code, {buffer.data(), p}, {buffer.data(), n_expected_bytes}, timeout)) {
+			if (r->size() != n_expected_bytes || buffer[0] != n_expected_bytes - 1) {
+				return std::error_code(Error::invalid_response);
+			}
+			for (std::size_t i = 0; i < n; ++i) {
+				values[i] = uint16_t(buffer[1 + i * 2]) << 8 | buffer[2 + i * 2];
+			}
+			return {};
+		} else {
+			return r.error();
+		}
+	}
+
+	template<std::size_t BufferSize, typename T>
+	error_or<void> write_bits(
+		byte_t slave_id,
+		uint16_t address,
+		range<T const> values,
+		std::size_t n,
+		timeout_t timeout
+	) {
+		byte_t n_data_bytes = (n + 7) / 8;
+		std::array<byte_t, BufferSize> request_buffer;
+		byte_t * p = request_buffer.data();
+		*p++ = address >> 8;
+		*p++ = address & 0xFF;
+		*p++ = n >> 8;
+		*p++ = n & 0xFF;
+		*p++ = n_data_bytes;
+		std::fill(p, p + n_data_bytes, 0);
+		for (std::size_t i = 0; i < n; ++i) {
+			if (values[i]) request_buffer[5 + i / 8] |= 1 << i % 8;
+		}
+		std::array<byte_t, 4> response;
+		if (auto r = transport_.raw_command(slave_id, 0x0F, {request_buffer.data(), p + n_data_bytes}, response, timeout)) {
+			if (*r != range<byte_t>(request_buffer.data(), 4)) {
+				return std::error_code(Error::invalid_response);
+			}
+			return {};
+		} else {
+			return r.error();
+		}
+	}
+
+	template<std::size_t BufferSize>
+	error_or<void> write_regs(
+		byte_t slave_id,
+		uint16_t address,
+		range<uint16_t const> values,
+		std::size_t n,
+		timeout_t timeout
+	) {
+		std::array<byte_t, BufferSize> request_buffer;
+		byte_t * p = request_buffer.data();
+		*p++ = address >> 8;
+		*p++ = address & 0xFF;
+		*p++ = n >> 8;
+		*p++ = n & 0xFF;
+		*p++ = n * 2;
+		for (std::size_t i = 0; i < n; ++i) {
+			*p++ = values[i] >> 8;
+			*p++ = values[i] & 0xFF;
+		}
+		std::array<byte_t, 4> response;
+		if (auto r = transport_.raw_command(slave_id, 0x10, {request_buffer.data(), p}, response, timeout)) {
+			if (*r != range<byte_t>(request_buffer.data(), 4)) {
+				return std::error_code(Error::invalid_response);
+			}
+			return {};
+		} else {
+			return r.error();
+		}
+	}
+
+	template<std::size_t BufferSize>
+	error_or<void> read_write_regs(
+		byte_t slave_id,
+		uint16_t write_address,
+		range<uint16_t const> write_values,
+		std::size_t n_write,
+		uint16_t read_address,
+		range<uint16_t> read_values,
+		std::size_t n_read,
+		timeout_t timeout
+	) {
+		std::array<byte_t, BufferSize> buffer;
+		byte_t * p = buffer.data();
+		*p++ = read_address >> 8;
+		*p++ = read_address & 0xFF;
+		*p++ = n_read >> 8;
+		*p++ = n_read & 0xFF;
+		*p++ = write_address >> 8;
+		*p++ = write_address & 0xFF;
+		*p++ = n_write >> 8;
+		*p++ = n_write & 0xFF;
+		*p++ = n_write * 2;
+		for (std::size_t i = 0; i < n_write; ++i) {
+			*p++ = write_values[i] >> 8;
+			*p++ = write_values[i] & 0xFF;
+		}
+		std::size_t n_expected_bytes = regs_response_size(n_read);
+		if (auto r = transport_.raw_command(slave_id, 0x17, {buffer.data(), p}, {buffer.data(), n_expected_bytes}, timeout)) {
+			if (r->size() != n_expected_bytes || (*r)[0] != n_expected_bytes - 1) {
+				return std::error_code(Error::invalid_response);
+			}
+			p = &buffer[1];
+			for (std::size_t i = 0; i < n_read; ++i) {
+				uint16_t high = *p++;
+				read_values[i] = high << 8 | *p++;
+			}
+			return {};
+		} else {
+			return r.error();
+		}
+	}
+
+public:
+	explicit Client(Transport & transport) : transport_(transport) {}
+
+	Transport & transport() { return transport_; }
+
+	// Function code 0x01.
+	error_or<void> read_coils(byte_t s, uint16_t a, range<bool> v, timeout_t t) {
+		if (v.size() > 2000) return std::error_code(Error::request_too_large);
+		return read_bits<251>(0x01, s, a, v, v.size(), t);
+	}
+	error_or<void> read_coils(byte_t s, uint16_t a, range<unsigned char> v, timeout_t t) {
+		if (v.size() > 2000) return std::error_code(Error::request_too_large);
+		return read_bits<251>(0x01, s, a, v, v.size(), t);
+	}
+	error_or<void> read_coils(byte_t s, uint16_t a, range<uint16_t> v, timeout_t t) {
+		if (v.size() > 2000) return std::error_code(Error::request_too_large);
+		return read_bits<251>(0x01, s, a, v, v.size(), t);
+	}
+	template<std::size_t N, typename T>
+	error_or<void> read_coils(byte_t s, uint16_t a, std::array<T, N> & v, timeout_t t) {
+		static_assert(N > 0 && N <= 2000, "Too many coils for one request.");
+		return read_bits<bits_response_size(N)>(0x01, s, a, range<T>(v), N, t);
+	}
+
+	// Function code 0x02.
+	error_or<void> read_inputs(byte_t s, uint16_t a, range<bool> v, timeout_t t) {
+		if (v.size() > 2000) return std::error_code(Error::request_too_large);
+		return read_bits<251>(0x02, s, a, v, v.size(), t);
+	}
+	error_or<void> read_inputs(byte_t s, uint16_t a, range<unsigned char> v, timeout_t t) {
+		if (v.size() > 2000) return std::error_code(Error::request_too_large);
+		return read_bits<251>(0x02, s, a, v, v.size(), t);
+	}
+	error_or<void> read_inputs(byte_t s, uint16_t a, range<uint16_t> v, timeout_t t) {
+		if (v.size() > 2000) return std::error_code(Error::request_too_large);
+		return read_bits<251>(0x02, s, a, v, v.size(), t);
+	}
+	template<std::size_t N, typename T>
+	error_or<void> read_inputs(byte_t s, uint16_t a, std::array<T, N> & v, timeout_t t) {
+		static_assert(N > 0 && N <= 2000, "Too many inputs for one request.");
+		return read_bits<bits_response_size(N)>(0x02, s, a, range<T>(v), N, t);
+	}
+
+	// Function code 0x03.
+	error_or<void> read_holding_registers(byte_t s, uint16_t a, range<uint16_t> v, timeout_t t) {
+		if (v.size() > 125) return std::error_code(Error::request_too_large);
+		return read_regs<251>(0x03, s, a, v, v.size(), t);
+	}
+	template<std::size_t N>
+	error_or<void> read_holding_registers(byte_t s, uint16_t a, std::array<uint16_t, N> & v, timeout_t t) {
+		static_assert(N > 0 && N <= 125, "Too many registers for one request.");
+		return read_regs<regs_response_size(N)>(0x03, s, a, v, N, t);
+	}
+
+	// Function code 0x04.
+	error_or<void> read_input_registers(byte_t s, uint16_t a, range<uint16_t> v, timeout_t t) {
+		if (v.size() > 125) return std::error_code(Error::request_too_large);
+		return read_regs<251>(0x04, s, a, v, v.size(), t);
+	}
+	template<std::size_t N>
+	error_or<void> read_input_registers(byte_t s, uint16_t a, std::array<uint16_t, N> & v, timeout_t t) {
+		static_assert(N > 0 && N <= 125, "Too many registers for one request.");
+		return read_regs<regs_response_size(N)>(0x04, s, a, v, N, t);
+	}
+
+	// Function code 0x05.
+	error_or<void> write_single_coil(
+		byte_t slave_id,
+		uint16_t address,
+		bool value,
+		timeout_t timeout
+	) {
+		std::array<byte_t, 4> request = {{
+			byte_t(address >> 8),
+			byte_t(address & 0xFF),
+			byte_t(value ? 0xFF : 0x00),
+			0x00
+		}};
+		std::array<byte_t, 4> response;
+		if (auto r = transport_.raw_command(slave_id, 0x05, request, response, timeout)) {
+			if (r->size() != request.size() || response != request) {
+				return std::error_code(Error::invalid_response);
+			}
+			return {};
+		} else {
+			return r.error();
+		}
+	}
+
+	// Function code 0x06.
+	error_or<void> write_single_register(
+		byte_t slave_id,
+		uint16_t address,
+		uint16_t value,
+		timeout_t timeout
+	) {
+		std::array<byte_t, 4> request = {{
+			byte_t(address >> 8),
+			byte_t(address & 0xFF),
+			byte_t(value >> 8),
+			byte_t(value & 0xFF)
+		}};
+		std::array<byte_t, 4> response;
+		if (auto r = transport_.raw_command(slave_id, 0x06, request, response, timeout)) {
+			if (*r != request) return std::error_code(Error::invalid_response);
+			return {};
+		} else {
+			return r.error();
+		}
+	}
+
+	// Function code 0x0F.
+	error_or<void> write_multiple_coils(byte_t s, uint16_t a, range<bool const> v, timeout_t t) {
+		if (v.size() > 1968) return std::error_code(Error::request_too_large);
+		return write_bits<251>(s, a, v, v.size(), t);
+	}
+	error_or<void> write_multiple_coils(byte_t s, uint16_t a, range<unsigned char const> v, timeout_t t) {
+		if (v.size() > 1968) return std::error_code(Error::request_too_large);
+		return write_bits<251>(s, a, v, v.size(), t);
+	}
+	error_or<void> write_multiple_coils(byte_t s, uint16_t a, range<uint16_t const> v, timeout_t t) {
+		if (v.size() > 1968) return std::error_code(Error::request_too_large);
+		return write_bits<251>(s, a, v, v.size(), t);
+	}
+	template<std::size_t N, typename T>
+	error_or<void> write_multiple_coils(byte_t s, uint16_t a, std::array<T, N> const & v, timeout_t t) {
+		static_assert(N > 0 && N <= 1968, "Too many coils for one request.");
+		return write_bits<5 + (N + 7) / 8>(s, a, range<T const>(v), N, t);
+	}
+
+	// Function code 0x10.
+	error_or<void> write_multiple_registers(byte_t s, uint16_t a, range<uint16_t const> v, timeout_t t) {
+		if (v.size() > 123) return std::error_code(Error::request_too_large);
+		return write_regs<251>(s, a, v, v.size(), t);
+	}
+	template<std::size_t N>
+	error_or<void> write_multiple_registers(byte_t s, uint16_t a, std::array<uint16_t, N> const & v, timeout_t t) {
+		static_assert(N > 0 && N <= 123, "Too many registers for one request.");
+		return write_regs<5 + N * 2>(s, a, v, N, t);
+	}
+
+	// Function code 0x14.
+	error_or<void> read_file_record(
+		byte_t slave_id,
+		range<Modbus::read_file_group> groups,
+		timeout_t timeout
+	) {
+		if (groups.size() > 35) return std::error_code(Error::request_too_large);
+		std::size_t n_expected_bytes = 1;
+		for (auto const & g : groups) {
+			n_expected_bytes += g.data.size() * 2 + 2;
+			if (n_expected_bytes > 251) return std::error_code(Error::request_too_large);
+		}
+		std::array<byte_t, 251> buffer;
+		buffer[0] = groups.size() * 7;
+		byte_t * p = &buffer[1];
+		for (auto const & g : groups) {
+			*p++ = 0x06;
+			*p++ = g.file_number >> 8;
+			*p++ = g.file_number & 0xFF;
+			*p++ = g.address >> 8;
+			*p++ = g.address & 0xFF;
+			*p++ = g.data.size() >> 8;
+			*p++ = g.data.size() & 0xFF;
+		}
+		if (auto r = transport_.raw_command(slave_id, 0x14, {buffer.data(), p}, {buffer.data(), n_expected_bytes}, timeout)) {
+			if (r->size() != n_expected_bytes || (*r)[0] != n_expected_bytes - 1) {
+				return std::error_code(Error::invalid_response);
+			}
+			p = &buffer[1];
+			for (auto const & g : groups) {
+				if (*p++ != 1 + g.data.size() * 2 || *p++ != 0x06) {
+					return std::error_code(Error::invalid_response);
+				}
+				for (uint16_t & v : g.data) {
+					uint16_t high = *p++;
+					v = high << 8 | *p++;
+				}
+			}
+			return {};
+		} else {
+			return r.error();
+		}
+	}
+
+	// Function code 0x15.
+	error_or<void> write_file_record(
+		byte_t slave_id,
+		range<Modbus::write_file_group> groups,
+		timeout_t timeout
+	) {
+		std::size_t n_bytes = 1;
+		for (auto const & g : groups) {
+			n_bytes += g.data.size() * 2 + 7;
+			if (n_bytes > 251) return std::error_code(Error::request_too_large);
+		}
+		std::array<byte_t, 251> request_buffer;
+		byte_t * p = request_buffer.data();
+		*p++ = n_bytes - 1;
+		for (auto const & g : groups) {
+			*p++ = 0x06;
+			*p++ = g.file_number >> 8;
+			*p++ = g.file_number & 0xFF;
+			*p++ = g.address >> 8;
+			*p++ = g.address & 0xFF;
+			*p++ = g.data.size() >> 8;
+			*p++ = g.data.size() & 0xFF;
+			for (uint16_t v : g.data) {
+				*p++ = v >> 8;
+				*p++ = v & 0xFF;
+			}
+		}
+		range<byte_t> request(request_buffer.data(), p);
+		std::array<byte_t, 251> response_buffer;
+		if (auto r = transport_.raw_command(slave_id, 0x15, request, {response_buffer.data(), request.size()}, timeout)) {
+			if (*r != request) return std::error_code(Error::invalid_response);
+			return {};
+		} else {
+			return r.error();
+		}
+	}
+
+	// Function code 0x16.
+	error_or<void> mask_write_register(
+		byte_t slave_id,
+		uint16_t address,
+		uint16_t and_mask,
+		uint16_t or_mask,
+		timeout_t timeout
+	) {
+		std::array<byte_t, 6> request = {{
+			byte_t(address >> 8),
+			byte_t(address & 0xFF),
+			byte_t(and_mask >> 8),
+			byte_t(and_mask & 0xFF),
+			byte_t(or_mask >> 8),
+			byte_t(or_mask & 0xFF)
+		}};
+		std::array<byte_t, 6> response;
+		if (auto r = transport_.raw_command(slave_id, 0x16, request, response, timeout)) {
+			if (*r != request) return std::error_code(Error::invalid_response);
+			return {};
+		} else {
+			return r.error();
+		}
+	}
+
+	// Function code 0x17.
+	error_or<void> read_write_registers(
+		byte_t slave_id,
+		uint16_t write_address,
+		range<uint16_t const> write_values,
+		uint16_t read_address,
+		range<uint16_t> read_values,
+		timeout_t timeout
+	) {
+		if (read_values.size() > 125 || write_values.size() > 121) {
+			return std::error_code(Error::request_too_large);
+		}
+		return read_write_regs<251>(
+			slave_id,
+			write_address, write_values, write_values.size(),
+			read_address, read_values, read_values.size(),
+			timeout
+		);
+	}
+	template<std::size_t W, std::size_t R>
+	error_or<void> read_write_registers(
+		byte_t slave_id,
+		uint16_t write_address,
+		std::array<uint16_t, W> const & write_values,
+		uint16_t read_address,
+		std::array<uint16_t, R> & read_values,
+		timeout_t timeout
+	) {
+		static_assert(W > 0 && W <= 121, "Too many registers to write in one request.");
+		static_assert(R > 0 && R <= 125, "Too many registers to read in one request.");
+		return read_write_regs<std::max(9 + W * 2, regs_response_size(R))>(
+			slave_id,
+			write_address, write_values, W,
+			read_address, read_values, R,
+			timeout
+		);
+	}
+
+	// Function code 0x18.
+	// Returns the number of registers that were in the queue, at most 31.
+	// The number is only known from the response, so values must have room
+	// for 31 registers.
+	error_or<std::size_t> read_fifo_queue(
+		byte_t slave_id,
+		uint16_t address,
+		range<uint16_t> values,
+		timeout_t timeout
+	) {
+		if (values.size() < 31) return std::error_code(Error::buffer_too_small);
+		std::array<byte_t, 4 + 31 * 2> buffer;
+		buffer[0] = address >> 8;
+		buffer[1] = address & 0xFF;
+		if (auto r = transport_.raw_command(slave_id, 0x18, {buffer.data(), 2}, buffer, timeout)) {
+			if (r->size() < 4) return std::error_code(Error::invalid_response);
+			std::size_t n_bytes = buffer[0] << 8 | buffer[1];
+			std::size_t n = buffer[2] << 8 | buffer[3];
+			if (n > 31 || n_bytes != 2 + n * 2 || r->size() != 2 + n_bytes) {
+				return std::error_code(Error::invalid_response);
+			}
+			byte_t const * p = &buffer[4];
+			for (std::size_t i = 0; i < n; ++i) {
+				uint16_t high = *p++;
+				values[i] = high << 8 | *p++;
+			}
+			return n;
+		} else if (r.error() == std::error_code(Error::illegal_data_value)) {
+			// The exception for a queue of more than 31 registers.
+			return std::error_code(Error::fifo_overflow);
+		} else {
+			return r.error();
+		}
+	}
+
+	template<std::size_t N>
+	error_or<std::size_t> read_fifo_queue(
+		byte_t slave_id,
+		uint16_t address,
+		std::array<uint16_t, N> & values,
+		timeout_t timeout
+	) {
+		static_assert(N >= 31, "A FIFO queue holds up to 31 registers.");
+		return read_fifo_queue(slave_id, address, range<uint16_t>(values), timeout);
+	}
+
+};
+
+template<typename Transport>
+Client<Transport> make_client(Transport & transport) {
+	return Client<Transport>(transport);
+}
+
+}
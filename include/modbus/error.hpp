@@ -18,9 +18,11 @@ enum class Error : int {
 	gateway_no_response      = 0x0B,
 	timeout                  = 0x100,
 	request_too_large        = 0x200,
+	buffer_too_small         = 0x201, // No room for the response.
 	bad_frame                = 0x301, // ADU too short or too long.
 	bad_crc                  = 0x302,
 	invalid_response         = 0x303, // CRC was ok.
+	fifo_overflow            = 0x400, // More than 31 registers queued.
 };
 
 class ErrorCategory : public std::error_category {
@@ -40,9 +42,11 @@ public:
 			case Error::gateway_no_response:      return "gateway no response";
 			case Error::timeout:                  return "timeout";
 			case Error::request_too_large:        return "request too large";
+			case Error::buffer_too_small:         return "buffer too small";
 			case Error::bad_frame:                return "bad frame";
 			case Error::bad_crc:                  return "bad crc";
 			case Error::invalid_response:         return "invalid response";
+			case Error::fifo_overflow:            return "fifo overflow";
 		}
 		return "unknown error " + std::to_string(condition);
 	}
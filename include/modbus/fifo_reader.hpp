@@ -0,0 +1,106 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <mstd/error_or.hpp>
+
+#include "modbus.hpp"
+
+namespace Modbus {
+
+// The registers returned by one read_fifo_queue (0x18) request.
+struct fifo_batch {
+	std::chrono::steady_clock::time_point time; // When the response arrived.
+	std::size_t size = 0;
+	std::array<uint16_t, 31> values;
+
+	uint16_t const * begin() const { return values.data(); }
+	uint16_t const * end() const { return values.data() + size; }
+};
+
+// Reads the FIFO queue of a slave with read_fifo_queue, and hands the
+// batches to a consumer through a bounded ring buffer.
+//
+// The protocol doesn't say whether reading the queue removes the registers
+// from it, so by default every drain() sends one request, and the caller
+// decides how often to poll. For a slave known to empty its queue on every
+// read, set_read_clears_queue() lets drain() keep reading while the
+// responses are full.
+//
+// drain() may be called from one (producer) thread, and front() and pop()
+// from another (consumer) thread. Responses are decoded directly into the
+// ring buffer, and the consumer reads them in place. Nothing is allocated
+// after construction.
+//
+// When the ring buffer is full, drain() stops reading, and the samples stay
+// queued in the slave.
+class FifoReader {
+
+	Modbus & bus_;
+	byte_t slave_id_;
+	uint16_t address_;
+	Modbus::timeout_t timeout_;
+	bool read_clears_ = false;
+
+	std::vector<fifo_batch> ring_;
+	std::atomic<std::size_t> head_{0}; // Next batch to be written by drain().
+	std::atomic<std::size_t> tail_{0}; // Next batch to be read by front().
+
+	std::atomic<std::uint64_t> samples_{0};
+	std::atomic<std::uint64_t> transactions_{0};
+	std::chrono::steady_clock::time_point first_drain_;
+
+public:
+	// The ring buffer holds capacity batches of up to 31 registers.
+	FifoReader(
+		Modbus & bus,
+		byte_t slave_id,
+		uint16_t address,
+		Modbus::timeout_t timeout,
+		std::size_t capacity = 64
+	) : bus_(bus), slave_id_(slave_id), address_(address), timeout_(timeout), ring_(capacity + 1) {}
+
+	// Whether the slave removes the registers from its queue when they are
+	// read. Off by default.
+	void set_read_clears_queue(bool clears) { read_clears_ = clears; }
+
+	// Read the FIFO queue once, unless the ring buffer is full. If the slave
+	// clears its queue on reading, keep reading until a response has fewer
+	// than 31 registers.
+	// Returns the number of registers read. A queue of more than 31 registers
+	// results in Error::fifo_overflow, after which the queue has to be
+	// emptied some other way, as read_fifo_queue can't read it.
+	error_or<std::size_t> drain();
+
+	// The oldest batch, or nullptr if there is none.
+	fifo_batch const * front() const {
+		std::size_t tail = tail_.load(std::memory_order_relaxed);
+		if (tail == head_.load(std::memory_order_acquire)) return nullptr;
+		return &ring_[tail];
+	}
+
+	// Release the batch returned by front().
+	void pop() {
+		std::size_t tail = tail_.load(std::memory_order_relaxed);
+		tail_.store(next(tail), std::memory_order_release);
+	}
+
+	// Total number of registers and read_fifo_queue requests so far.
+	std::uint64_t samples() const { return samples_.load(std::memory_order_relaxed); }
+	std::uint64_t transactions() const { return transactions_.load(std::memory_order_relaxed); }
+
+	// Registers per second, since the first call to drain().
+	// Only valid to call from the producer thread.
+	double ingest_rate(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now()) const;
+
+private:
+	std::size_t next(std::size_t i) const { return i + 1 == ring_.size() ? 0 : i + 1; }
+
+};
+
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <mstd/error_or.hpp>
+#include <mstd/range.hpp>
+
+#include "modbus.hpp"
+
+namespace Modbus {
+
+// An archive of polled register blocks, in a chunked columnar file.
+//
+// Every chunk holds up to chunk_size samples of one block of registers
+// (slave id, address and number of registers). The timestamps are stored as
+// deltas of deltas, and every register as its own column of values XORed
+// with the previous value, both using a variable number of bits (as in
+// Facebook's Gorilla). A slowly changing register takes about one bit per
+// sample.
+//
+// Each chunk header holds the time range of the chunk, and the minimum and
+// maximum value of every register, such that queries skip chunks without
+// decoding them. All numbers are little endian.
+
+using historian_clock = std::chrono::system_clock;
+
+class HistorianWriter {
+
+	struct file_closer {
+		void operator()(std::FILE * f) const { std::fclose(f); }
+	};
+
+	struct chunk_builder;
+
+	std::size_t chunk_size_;
+	std::unique_ptr<std::FILE, file_closer> file_;
+	// Key: slave id, address and number of registers.
+	std::map<std::uint64_t, std::unique_ptr<chunk_builder>> series_;
+
+	error_or<void> write_chunk(chunk_builder & c);
+
+public:
+	// chunk_size is the number of samples per chunk, at most 65535.
+	explicit HistorianWriter(std::size_t chunk_size = 1024);
+
+	// Flushes, ignoring errors. Call flush() first to see them.
+	~HistorianWriter();
+
+	// Open a file to append to. It is created if it does not exist. An
+	// incomplete last chunk (e.g. after a crash) is cut off first, so the
+	// new chunks start at a chunk boundary.
+	error_or<void> open(char const * file_name);
+
+	// Add a block of registers, read at the given time.
+	// The values are encoded directly, without keeping a copy. A chunk is
+	// written to the file when it is full.
+	error_or<void> append(
+		byte_t slave_id,
+		uint16_t address,
+		range<uint16_t const> values,
+		historian_clock::time_point time = historian_clock::now()
+	);
+
+	// Write all chunks that are not full yet, and flush the file.
+	error_or<void> flush();
+
+};
+
+// A chunk in a file opened by HistorianReader.
+struct historian_chunk {
+	byte_t slave_id;
+	uint16_t address;
+	uint16_t count;   // Number of registers.
+	uint16_t samples;
+	historian_clock::time_point first;
+	historian_clock::time_point last;
+
+	// Index of every register (0 <= i < count).
+	uint16_t min(std::size_t i) const;
+	uint16_t max(std::size_t i) const;
+
+	byte_t const * header;
+	byte_t const * payload;
+	std::size_t payload_size;
+};
+
+// Selects the samples of one register.
+struct historian_query {
+	byte_t slave_id;
+	uint16_t address;
+	// Only samples in [from, to).
+	historian_clock::time_point from = historian_clock::time_point::min();
+	historian_clock::time_point to = historian_clock::time_point::max();
+	// Only values in [min_value, max_value].
+	uint16_t min_value = 0;
+	uint16_t max_value = 0xFFFF;
+};
+
+// Reads a file written by HistorianWriter, through a read-only memory
+// mapping. An incomplete chunk at the end of the file (e.g. after a crash
+// while writing) is ignored.
+class HistorianReader {
+
+	void * map_ = nullptr;
+	std::size_t size_ = 0;
+	std::vector<historian_chunk> chunks_;
+
+public:
+	HistorianReader() = default;
+	HistorianReader(HistorianReader const &) = delete;
+	HistorianReader & operator=(HistorianReader const &) = delete;
+
+	~HistorianReader() { close(); }
+
+	error_or<void> open(char const * file_name);
+
+	void close();
+
+	// All chunks, in the order they were written.
+	range<historian_chunk const> chunks() const { return {chunks_.data(), chunks_.size()}; }
+
+	// Call f(time, value) for every matching sample, in the order they were
+	// written. Chunks that cannot contain matching samples are skipped.
+	error_or<void> query(
+		historian_query const & q,
+		std::function<void (historian_clock::time_point, uint16_t)> const & f
+	) const;
+
+};
+
+}
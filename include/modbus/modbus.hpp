@@ -1,6 +1,7 @@
 #pragma once
 
 #include <chrono>
+#include <cstddef>
 #include <cstdint>
 
 #include <mstd/error_or.hpp>
@@ -141,6 +142,28 @@ public:
 		else return write_multiple_registers(slave_id, address, values, timeout);
 	}
 
+	// Broadcast variants of the write functions: write to all slaves at once,
+	// using slave id 0. Slaves never answer a broadcast, so success only means
+	// the request was sent. (See broadcast.hpp to verify the result.)
+	error_or<void> broadcast_write_single_coil(uint16_t address, bool value) {
+		return broadcast_sent(write_single_coil(0, address, value, timeout_t(0)));
+	}
+	error_or<void> broadcast_write_single_register(uint16_t address, uint16_t value) {
+		return broadcast_sent(write_single_register(0, address, value, timeout_t(0)));
+	}
+	error_or<void> broadcast_write_coils(uint16_t address, range<bool const> values) {
+		return broadcast_sent(write_coils(0, address, values, timeout_t(0)));
+	}
+	error_or<void> broadcast_write_coils(uint16_t address, range<unsigned char const> values) {
+		return broadcast_sent(write_coils(0, address, values, timeout_t(0)));
+	}
+	error_or<void> broadcast_write_coils(uint16_t address, range<uint16_t const> values) {
+		return broadcast_sent(write_coils(0, address, values, timeout_t(0)));
+	}
+	error_or<void> broadcast_write_registers(uint16_t address, range<uint16_t const> values) {
+		return broadcast_sent(write_registers(0, address, values, timeout_t(0)));
+	}
+
 	struct read_file_group {
 		uint16_t file_number;
 		uint16_t address;
@@ -186,6 +209,22 @@ public:
 		timeout_t timeout
 	);
 
+	// Function code 0x18.
+	// Reads the registers queued at the given FIFO pointer address. Returns
+	// the number of registers read, at most 31. The number is only known from
+	// the response, so values must have room for 31 registers. If not,
+	// Error::buffer_too_small is returned without sending anything.
+	// A slave with more than 31 queued registers responds with exception 03,
+	// which is returned as Error::fifo_overflow. The protocol does not say
+	// whether reading removes the registers from the queue; that depends on
+	// the slave.
+	error_or<std::size_t> read_fifo_queue(
+		byte_t slave_id,
+		uint16_t address,
+		range<uint16_t> values,
+		timeout_t timeout
+	);
+
 	// Send a raw command.
 	// If the result does not fit into response_buffer, Error::invalid_response
 	// is returned. On success, the subrange (starting at the first byte) of
@@ -200,6 +239,13 @@ public:
 		timeout_t timeout
 	) = 0;
 
+private:
+	// A request sent with timeout == 0 returns Error::timeout once sent.
+	static error_or<void> broadcast_sent(error_or<void> r) {
+		if (r.error() == std::error_code(Error::timeout)) return {};
+		return r;
+	}
+
 };
 
 }
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace Modbus {
+
+// Histogram of response times, with logarithmic buckets (four per power of
+// two) from 64µs up to about 16s.
+//
+// Once it holds max_samples samples, all counts are halved, such that the
+// recent behaviour of a slave outweighs its history.
+class ResponseTimeHistogram {
+
+public:
+	static constexpr std::size_t n_buckets = 73;
+	static constexpr std::uint32_t max_samples = 2048;
+
+private:
+	std::array<std::uint32_t, n_buckets> counts_ = {};
+	std::uint32_t size_ = 0;
+
+	static std::size_t bucket(std::uint64_t us);
+	static std::uint64_t upper_bound(std::size_t bucket);
+
+public:
+	void add(std::chrono::microseconds t);
+
+	std::uint32_t size() const { return size_; }
+
+	// An upper bound for the given fraction (e.g. 0.99) of the samples.
+	// Returns zero if there are no samples.
+	std::chrono::microseconds percentile(double p) const;
+
+	void clear() {
+		counts_ = {};
+		size_ = 0;
+	}
+
+};
+
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <chrono>
+
+#include <mstd/error_or.hpp>
+
+namespace Modbus {
+
+struct rs485_settings {
+	// Drive RTS high (instead of low) while sending.
+	bool rts_on_send = true;
+	// Keep receiving while sending. Leave this off to suppress the local echo.
+	bool rx_during_tx = false;
+	std::chrono::milliseconds delay_before_send{0};
+	std::chrono::milliseconds delay_after_send{0};
+};
+
+// Let the Linux serial driver switch the RS-485 transceiver direction
+// (TIOCSRS485), given the file descriptor of an opened serial port.
+//
+// Only available on Linux. Not all drivers support this, in which case the
+// ioctl error is returned (in the generic category).
+mstd::error_or<void> enable_rs485(int fd, rs485_settings const & settings = {});
+
+// The same, given the device (e.g. "/dev/ttyS1"), which is opened only for
+// the ioctl. The driver keeps the mode after that, so this works for a
+// Serial::Port opened before or after, which doesn't expose its file
+// descriptor.
+mstd::error_or<void> enable_rs485(char const * device, rs485_settings const & settings = {});
+
+// Switch the driver back to RS-232 mode.
+mstd::error_or<void> disable_rs485(int fd);
+
+mstd::error_or<void> disable_rs485(char const * device);
+
+}
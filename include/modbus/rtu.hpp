@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <mstd/error_or.hpp>
+#include <mstd/range.hpp>
+
+#include "crc.hpp"
+#include "modbus.hpp"
+
+namespace Modbus {
+
+// Write an RTU ADU (slave id, function code, parameters, crc) to out.
+// out must have room for parameters.size() + 4 bytes.
+// Returns the size of the ADU.
+std::size_t rtu_encode(
+	byte_t slave_id,
+	byte_t function_code,
+	range<byte_t const> parameters,
+	byte_t * out
+);
+
+// Validates an RTU response, one byte at a time, and copies the data into
+// the response buffer.
+//
+// This does not know where a frame ends. The transport decides that, based
+// on timing (serial lines) or expected_size() and crc_ok() (stream and
+// datagram transports).
+class RtuResponseParser {
+
+	byte_t slave_id_;
+	byte_t function_code_;
+	range<byte_t> response_buffer_;
+	crc_ibm crc_;
+	std::size_t size_ = 0;
+	bool is_invalid_response_ = false;
+	bool is_exception_response_ = false;
+	byte_t exception_code_ = 0;
+
+public:
+	RtuResponseParser(byte_t slave_id, byte_t function_code, range<byte_t> response_buffer)
+		: slave_id_(slave_id), function_code_(function_code), response_buffer_(response_buffer) {}
+
+	void add(byte_t b);
+
+	void add(range<byte_t const> r) {
+		for (byte_t b : r) add(b);
+	}
+
+	// Number of bytes received so far.
+	std::size_t size() const { return size_; }
+
+	// The size of an exception response, once that is recognized, and
+	// otherwise the size of a response that fills the whole response buffer.
+	std::size_t expected_size() const {
+		return is_exception_response_ ? 5 : response_buffer_.size() + 4;
+	}
+
+	// Whether the bytes so far end in a valid crc.
+	bool crc_ok() const { return size_ >= 4 && crc_.get() == 0; }
+
+	// Whether the bytes so far are a full response of the expected size, or
+	// a full exception response.
+	bool complete() const { return crc_ok() && size_ == expected_size(); }
+
+	// Check the frame, and return the response data or error.
+	// Call this after the transport decided the frame has ended.
+	error_or<range<byte_t>> result() const;
+
+};
+
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#include <mstd/error_or.hpp>
+#include <mstd/range.hpp>
+
+#include "modbus.hpp"
+
+namespace Modbus {
+
+// Modbus RTU frames tunneled over TCP or UDP, as done by most serial device
+// servers in their 'raw' mode.
+//
+// The frames are exactly those of ModbusSerialRtu, including the crc.
+// Since there is no UART silence to delimit frames, a response ends when it
+// reaches the expected size, or when it has a valid crc and no more data
+// follows within a short pause. For UDP, a datagram that ends in a valid crc
+// ends the response.
+//
+// Errors from the system (e.g. a refused connection) are in the generic
+// category, as everywhere in this library.
+//
+// Only available on POSIX systems.
+class ModbusRtuSocket final : public Modbus {
+
+public:
+	enum class Protocol { tcp, udp };
+
+private:
+	int fd_ = -1;
+	Protocol protocol_ = Protocol::tcp;
+	std::chrono::milliseconds gap_timeout_{100};
+
+	void discard_pending();
+
+public:
+	ModbusRtuSocket() {}
+	ModbusRtuSocket(ModbusRtuSocket const &) = delete;
+	ModbusRtuSocket & operator=(ModbusRtuSocket const &) = delete;
+	~ModbusRtuSocket() { close(); }
+
+	// Resolve host and service (e.g. "192.168.1.10" and "4001"), and connect.
+	error_or<void> connect(Protocol protocol, char const * host, char const * service);
+
+	void close();
+
+	int fd() const { return fd_; }
+
+	// Maximum time between two parts of a single response.
+	// This is more generous than on a serial line, since the network (e.g.
+	// Nagle's algorithm combined with delayed acknowledgements) can add tens
+	// of milliseconds. It only matters for incomplete responses.
+	void set_gap_timeout(std::chrono::milliseconds t) { gap_timeout_ = t; }
+
+	error_or<range<byte_t>> raw_command(
+		byte_t slave_id,
+		byte_t function_code,
+		range<byte_t const> parameters,
+		range<byte_t> response_buffer,
+		timeout_t timeout
+	) override;
+
+};
+
+}
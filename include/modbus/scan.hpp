@@ -0,0 +1,78 @@
+#pragma once
+
+#include <bitset>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include <mstd/error_or.hpp>
+#include <mstd/range.hpp>
+
+#include "modbus.hpp"
+
+namespace Modbus {
+
+// What is known about a slave device.
+struct DeviceProfile {
+	byte_t slave_id = 0;
+
+	// Function codes known to be supported or not supported.
+	// Function codes in neither set were not probed.
+	std::bitset<128> supported;
+	std::bitset<128> unsupported;
+
+	// Largest number of registers and coils (or inputs) that could be read
+	// in one request. Zero if unknown.
+	uint16_t max_read_registers = 0;
+	uint16_t max_read_coils = 0;
+
+	// Typical duration of a whole transaction. Zero if unknown.
+	std::chrono::microseconds typical_latency{0};
+
+	// Whether the line to this slave echoes the requests (see
+	// ModbusSerialRtu::set_local_echo).
+	enum class Echo : unsigned char { unknown, none, local };
+	Echo echo = Echo::unknown;
+
+	bool supports(byte_t function_code) const {
+		return function_code < 128 && supported[function_code];
+	}
+
+	bool known_unsupported(byte_t function_code) const {
+		return function_code < 128 && unsupported[function_code];
+	}
+};
+
+// Find the slaves that respond, by sending each of them a small read.
+// Any response, including exception responses, counts. A short timeout
+// (e.g. SerialSettings::first_byte_timeout) keeps a full sweep fast.
+std::vector<byte_t> scan(
+	Modbus & bus,
+	byte_t first_slave_id,
+	byte_t last_slave_id,
+	Modbus::timeout_t timeout,
+	uint16_t address = 0
+);
+
+// Find the supported function codes, and the maximum number of registers
+// and coils per read (using a binary search), of a slave.
+//
+// Only reading requests are sent, and requests that are invalid by
+// specification (e.g. writing zero registers), to which a device that
+// supports the function answers with Error::illegal_data_value. Function
+// codes that cannot be probed without side effects (0x05, 0x06 and 0x16)
+// are left unknown. (Many slaves treat any coil value other than 0xFF00 as
+// off, so even an invalid 0x05 request could switch a coil.)
+//
+// The read limits are probed starting at the given address. A limit is
+// only lowered by an exception response for the quantity or address range,
+// not by a timeout or a damaged frame. If those persist, the limit is left
+// unknown.
+DeviceProfile probe(
+	Modbus & bus,
+	byte_t slave_id,
+	Modbus::timeout_t timeout,
+	uint16_t address = 0
+);
+
+}
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <system_error>
+
+#include <mstd/error_or.hpp>
+#include <mstd/range.hpp>
+#include <serial/serial.hpp>
+
+#include "modbus.hpp"
+#include "response_time.hpp"
+
+namespace Modbus {
+
+struct SerialSettings {
+	unsigned int baud_rate = 19200;
+	Serial::Parity parity = Serial::Parity::even;
+	Serial::StopBits stop_bits = Serial::StopBits::one;
+	Serial::DataBits data_bits = Serial::DataBits::eight;
+
+	// Start bit, data bits, parity bit and stop bits.
+	unsigned int bits_per_character() const {
+		return 1
+			+ (data_bits == Serial::DataBits::seven ? 7 : 8)
+			+ (parity == Serial::Parity::none ? 0 : 1)
+			+ (stop_bits == Serial::StopBits::two ? 2 : 1);
+	}
+
+	std::chrono::microseconds character_time() const {
+		return std::chrono::microseconds(bits_per_character() * 1000000ull / baud_rate);
+	}
+
+	// Time to transmit n characters.
+	std::chrono::microseconds transmit_time(std::size_t n) const {
+		return std::chrono::microseconds(n * bits_per_character() * 1000000ull / baud_rate);
+	}
+
+	// A short timeout to wait for the first byte of a response: the time to
+	// transmit the request and t3.5, plus the time the slave needs.
+	std::chrono::milliseconds first_byte_timeout(std::size_t request_size, std::chrono::milliseconds processing) const {
+		auto t = transmit_time(request_size) + frame_gap() + processing;
+		return std::chrono::duration_cast<std::chrono::milliseconds>(t) + std::chrono::milliseconds(1);
+	}
+
+	// The silent interval between RTU frames (t3.5).
+	// Fixed at 1750µs above 19200 baud, as recommended by the specification.
+	std::chrono::microseconds frame_gap() const {
+		if (baud_rate > 19200) return std::chrono::microseconds(1750);
+		return std::chrono::microseconds(35 * bits_per_character() * 100000ull / baud_rate);
+	}
+};
+
+// Information about a finished transaction, for instrumentation.
+struct transaction_info {
+	byte_t slave_id;
+	byte_t function_code;
+	std::size_t request_size;  // Bytes on the wire.
+	std::size_t response_size; // Bytes on the wire, 0 if nothing was received.
+	std::error_code error;
+	std::chrono::steady_clock::time_point start;
+	std::chrono::steady_clock::duration duration;
+	// From when the request was handed to the port (so including the time
+	// to transmit it, and to read back a local echo) until the first byte of
+	// the response. Zero if nothing was received.
+	std::chrono::steady_clock::duration response_time;
+};
+
+// Settings for learning the first-byte timeout from the response times of
+// each slave.
+struct adaptive_timeout_settings {
+	// The timeout is this percentile of the response times, plus the margin,
+	// limited to [floor, ceiling].
+	double percentile = 0.99;
+	std::chrono::milliseconds margin{5};
+	std::chrono::milliseconds floor{10};
+	std::chrono::milliseconds ceiling{1000};
+	// Until a slave answered this many times, the given timeout is used.
+	unsigned int min_samples = 20;
+};
+
+enum class Framing {
+	rtu,
+	ascii,
+};
+
+// Common base for the serial line transports (RTU and ASCII).
+//
+// Keeps the port together with its settings, and reports every transaction
+// to the transaction hook, if one is set. The framing itself is done by
+// serial_command(), which is implemented by the derived classes.
+class ModbusSerial : public Modbus {
+
+protected:
+	Serial::Port port_;
+	SerialSettings settings_;
+	std::function<void (transaction_info const &)> transaction_hook_;
+	std::chrono::microseconds turnaround_delay_{-1};
+	std::chrono::microseconds broadcast_delay_{-1};
+	std::chrono::steady_clock::time_point last_transaction_end_;
+	// Time to transmit the last request, if it was a broadcast.
+	std::chrono::microseconds last_broadcast_time_{-1};
+	bool adaptive_timeout_ = false;
+	adaptive_timeout_settings adaptive_timeout_settings_;
+	std::map<byte_t, ResponseTimeHistogram> response_times_;
+	std::chrono::milliseconds transaction_deadline_{0};
+	std::chrono::steady_clock::time_point deadline_;
+
+	// The given timeout, shortened such that it does not extend beyond the
+	// transaction deadline.
+	std::chrono::milliseconds limit_timeout(std::chrono::milliseconds t) const;
+
+	bool past_deadline() const {
+		return transaction_deadline_.count() && std::chrono::steady_clock::now() >= deadline_;
+	}
+
+	// The framing specific part of raw_command().
+	// Should set info.request_size, info.response_size and info.response_time,
+	// use limit_timeout() for every read, and return Error::timeout when
+	// past_deadline().
+	virtual error_or<range<byte_t>> serial_command(
+		byte_t slave_id,
+		byte_t function_code,
+		range<byte_t const> parameters,
+		range<byte_t> response_buffer,
+		timeout_t timeout,
+		transaction_info & info
+	) = 0;
+
+	// The number of bytes on the wire of a request with the given number of
+	// parameter bytes.
+	virtual std::size_t request_size(std::size_t parameters_size) const = 0;
+
+public:
+	// Assumes the port is already configured with the given settings (or
+	// that configure() is called before use). All timing (turnaround delay,
+	// broadcast delay, timeouts) is derived from them, so they must match.
+	// The default is the Modbus default, 19200 8E1.
+	explicit ModbusSerial(Serial::Port port, SerialSettings settings = {})
+		: port_(std::move(port)), settings_(settings) {}
+
+	Serial::Port & port() { return port_; }
+
+	virtual Framing framing() const = 0;
+
+	SerialSettings const & settings() const { return settings_; }
+
+	// Reconfigure the port. On failure, the settings are unchanged.
+	error_or<void> configure(SerialSettings settings) {
+		if (auto e = port_.set(settings.baud_rate, settings.parity, settings.stop_bits, settings.data_bits).error()) return e;
+		settings_ = settings;
+		return {};
+	}
+
+	// The minimum time between the end of one transaction and the start of
+	// the next one. Gives slaves (and RS-485 transceivers) time to release
+	// the line. A negative value (the default) means t3.5, derived from the
+	// baud rate.
+	void set_turnaround_delay(std::chrono::microseconds d) { turnaround_delay_ = d; }
+
+	std::chrono::microseconds turnaround_delay() const {
+		return turnaround_delay_.count() >= 0 ? turnaround_delay_ : settings_.frame_gap();
+	}
+
+	// The time slaves get to process a broadcast (slave id 0) before the next
+	// transaction. The specification recommends 100 to 200ms. As the port may
+	// still be transmitting when the write returns, the time to transmit the
+	// broadcast at the configured baud rate is added to this delay. A negative
+	// value (the default) means 100ms.
+	void set_broadcast_delay(std::chrono::microseconds d) { broadcast_delay_ = d; }
+
+	std::chrono::microseconds broadcast_delay() const {
+		if (broadcast_delay_.count() >= 0) return broadcast_delay_;
+		return std::chrono::milliseconds(100);
+	}
+
+	// Learn the response times of each slave, and use them instead of the
+	// given timeout (if that is longer) to wait for the first byte.
+	// A lost frame then costs little more than a typical response time.
+	// What is learned is the time the slave needs after receiving the
+	// request, so the time to transmit each request is added back to the
+	// timeout, and large requests don't time out early.
+	void enable_adaptive_timeout(adaptive_timeout_settings settings = {}) {
+		adaptive_timeout_ = true;
+		adaptive_timeout_settings_ = settings;
+	}
+
+	void disable_adaptive_timeout() { adaptive_timeout_ = false; }
+
+	// The learned response times of a slave (without the time to transmit
+	// the requests), or nullptr if it never answered.
+	ResponseTimeHistogram const * response_times(byte_t slave_id) const {
+		auto i = response_times_.find(slave_id);
+		return i == response_times_.end() ? nullptr : &i->second;
+	}
+
+	// A hard limit for a whole transaction, including sending the request
+	// and receiving the full response. Zero (the default) means no limit.
+	void set_transaction_deadline(std::chrono::milliseconds d) { transaction_deadline_ = d; }
+
+	// Called after every transaction, successful or not.
+	void set_transaction_hook(std::function<void (transaction_info const &)> hook) {
+		transaction_hook_ = std::move(hook);
+	}
+
+	error_or<range<byte_t>> raw_command(
+		byte_t slave_id,
+		byte_t function_code,
+		range<byte_t const> parameters,
+		range<byte_t> response_buffer,
+		timeout_t timeout
+	) override;
+
+};
+
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#include <mstd/error_or.hpp>
+#include <mstd/range.hpp>
+#include <serial/serial.hpp>
+
+#include "modbus.hpp"
+#include "serial.hpp"
+
+namespace Modbus {
+
+class ModbusSerialAscii final : public ModbusSerial {
+
+private:
+	// The specification allows up to one second between characters.
+	std::chrono::milliseconds character_timeout_{1000};
+
+protected:
+	error_or<range<byte_t>> serial_command(
+		byte_t slave_id,
+		byte_t function_code,
+		range<byte_t const> parameters,
+		range<byte_t> response_buffer,
+		std::chrono::milliseconds timeout,
+		transaction_info & info
+	) override;
+
+	std::size_t request_size(std::size_t parameters_size) const override {
+		// ':', slave id, function code, parameters and LRC in hex, CR, LF.
+		return 1 + 2 * (parameters_size + 3) + 2;
+	}
+
+public:
+	// Modbus ASCII uses seven data bits by default.
+	static SerialSettings default_settings() {
+		SerialSettings s;
+		s.data_bits = Serial::DataBits::seven;
+		return s;
+	}
+
+	explicit ModbusSerialAscii(Serial::Port port, SerialSettings settings = default_settings())
+		: ModbusSerial(std::move(port), settings) {}
+
+	Framing framing() const override { return Framing::ascii; }
+
+	// Maximum time between two characters of a response.
+	// Frames are delimited by ':' and CR LF, so this only matters for
+	// responses that get cut off.
+	void set_character_timeout(std::chrono::milliseconds t) { character_timeout_ = t; }
+
+};
+
+}
@@ -8,28 +8,50 @@
 #include <serial/serial.hpp>
 
 #include "modbus.hpp"
+#include "serial.hpp"
 
 namespace Modbus {
 
-class ModbusSerialRtu : public Modbus {
+class ModbusSerialRtu final : public ModbusSerial {
 
 private:
-	Serial::Port port_;
+	bool local_echo_ = false;
 
-public:
-	explicit ModbusSerialRtu(Serial::Port port)
-		: port_(std::move(port)) {}
-
-	Serial::Port & port() { return port_; }
-
-	error_or<range<byte_t>> raw_command(
+protected:
+	error_or<range<byte_t>> serial_command(
 		byte_t slave_id,
 		byte_t function_code,
 		range<byte_t const> parameters,
 		range<byte_t> response_buffer,
-		std::chrono::milliseconds timeout
+		std::chrono::milliseconds timeout,
+		transaction_info & info
 	) override;
 
+	std::size_t request_size(std::size_t parameters_size) const override {
+		return parameters_size + 4; // Slave id, function code, and crc.
+	}
+
+public:
+	explicit ModbusSerialRtu(Serial::Port port, SerialSettings settings = {})
+		: ModbusSerial(std::move(port), settings) {}
+
+	Framing framing() const override { return Framing::rtu; }
+
+	// Set this for half-duplex (RS-485) adapters that receive every byte
+	// they transmit. The echoed request is then read back and verified before
+	// the response is read. (On Linux, enable_rs485() with the name of the
+	// device can often make the driver handle the direction switching and
+	// suppress the echo instead. The tool does that with -d.)
+	void set_local_echo(bool echo) { local_echo_ = echo; }
+
+	bool local_echo() const { return local_echo_; }
+
+	// Find out whether the line to a slave echoes requests, by reading one
+	// register without and then with set_local_echo(true), and seeing which
+	// one gets a valid response. Returns the error of the last attempt if
+	// neither does. The local echo setting is left unchanged.
+	error_or<bool> detect_echo(byte_t slave_id, timeout_t timeout, uint16_t address = 0);
+
 };
 
 }
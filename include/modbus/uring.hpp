@@ -0,0 +1,106 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <system_error>
+#include <vector>
+
+#include <mstd/error_or.hpp>
+#include <mstd/range.hpp>
+
+#include "modbus.hpp"
+
+struct io_uring;
+
+namespace Modbus {
+
+// Timing of a line driven by UringEngine.
+struct uring_line_timing {
+	// The time to transmit one character. The first byte timeout is extended
+	// by the time to transmit the request. Zero for sockets.
+	std::chrono::microseconds character_time{0};
+
+	// A pause this long ends a response. On a serial line, this would be
+	// t3.5, but scheduling delays make a larger value (as used by
+	// ModbusSerialRtu) more reliable.
+	std::chrono::microseconds frame_gap{20000};
+};
+
+// Runs Modbus RTU transactions on many lines from a single thread, using
+// Linux io_uring.
+//
+// A line is a file descriptor that carries RTU frames: a configured serial
+// port, or a socket to a serial device server (see ModbusRtuSocket). Every
+// line runs one transaction at a time, but all lines run concurrently.
+//
+// Requests and responses live in one preallocated buffer that is registered
+// with the kernel, so responses are read directly into it. The first byte
+// timeout and the frame gap are linked timeouts on the reads. Submissions
+// and completions are batched: run_once() handles all completions that are
+// ready, and then submits all follow-up requests at once.
+//
+// Only available when built with MODBUS_IO_URING (and liburing).
+class UringEngine {
+
+public:
+	// Called when a transaction finishes. On success, the response data
+	// (without function code) is given in place, in the registered buffer.
+	// It is only valid during the call.
+	using callback = std::function<void (error_or<range<byte_t>>)>;
+
+private:
+	struct line;
+
+	std::unique_ptr<io_uring> ring_;
+	std::vector<byte_t> buffers_;
+	std::vector<std::unique_ptr<line>> lines_;
+	std::size_t max_lines_ = 0;
+	std::size_t pending_ = 0;
+
+	std::error_code submit_write(line & l);
+	std::error_code submit_read(line & l, std::chrono::microseconds timeout);
+	void handle(line & l, int result);
+	void finish(line & l, error_or<range<byte_t>> result);
+
+public:
+	UringEngine();
+	UringEngine(UringEngine const &) = delete;
+	UringEngine & operator=(UringEngine const &) = delete;
+	~UringEngine();
+
+	// Set up the ring and the buffers for at most max_lines lines.
+	error_or<void> init(std::size_t max_lines, unsigned int queue_depth = 256);
+
+	// Add a line. The file descriptor is not owned by the engine, and must
+	// stay open. Returns the index of the line.
+	error_or<std::size_t> add_line(int fd, uring_line_timing timing = {});
+
+	bool busy(std::size_t line) const;
+
+	// Number of transactions in progress.
+	std::size_t pending() const { return pending_; }
+
+	// Start a transaction on an idle line. response_size is the expected
+	// size of the response data (as the response_buffer of
+	// Modbus::raw_command). The request is submitted by the next
+	// run_once().
+	error_or<void> start(
+		std::size_t line,
+		byte_t slave_id,
+		byte_t function_code,
+		range<byte_t const> parameters,
+		std::size_t response_size,
+		Modbus::timeout_t timeout,
+		callback done
+	);
+
+	// Submit all queued requests, wait up to max_wait for a completion, and
+	// handle all completions. Callbacks run from here.
+	error_or<void> run_once(std::chrono::milliseconds max_wait);
+
+};
+
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <bitset>
+#include <chrono>
+#include <cstdint>
+#include <map>
+
+#include <mstd/error_or.hpp>
+
+#include "modbus.hpp"
+
+namespace Modbus {
+
+// Collects register and coil writes, and sends them using as few
+// transactions as possible.
+//
+// Repeated writes to the same address only send the last value. Adjacent
+// dirty addresses of the same slave are merged into write_multiple_registers
+// and write_multiple_coils requests, split at the protocol limits of 123
+// registers and 1968 coils.
+//
+// Nothing is sent until commit() or flush_if_due() is called.
+//
+// The order of the writes is not preserved. commit() handles the slaves by
+// ascending id, and sends for each slave first the registers by ascending
+// address, then the coils, then the write_register_bits() writes. When a
+// write must reach the slave after another (e.g. parameters before the
+// register that starts a drive), call commit() in between.
+class WriteBuffer {
+
+public:
+	using clock = std::chrono::steady_clock;
+
+	explicit WriteBuffer(Modbus & bus, clock::duration max_delay = std::chrono::milliseconds(10))
+		: bus_(bus), max_delay_(max_delay) {}
+
+	void write_register(byte_t slave_id, uint16_t address, uint16_t value);
+
+	void write_coil(byte_t slave_id, uint16_t address, bool value);
+
+	// Only changes the bits of the register that are set in mask.
+	// Uses mask_write_register (0x16) when the slave supports it, and falls
+	// back to a read-modify-write otherwise. When the full register is also
+	// dirty, the bits are simply merged into its pending value.
+	void write_register_bits(byte_t slave_id, uint16_t address, uint16_t mask, uint16_t value);
+
+	// By default, mask_write_register is assumed to be supported until the
+	// slave responds with Error::illegal_function.
+	void set_mask_write_supported(byte_t slave_id, bool supported) {
+		no_mask_write_[slave_id] = !supported;
+	}
+
+	// By default, read_write_registers is assumed to be supported until the
+	// slave responds with Error::illegal_function.
+	void set_read_write_supported(byte_t slave_id, bool supported) {
+		no_read_write_[slave_id] = !supported;
+	}
+
+	bool empty() const { return slaves_.empty(); }
+
+	// True if the oldest unflushed write is older than max_delay.
+	bool due(clock::time_point now = clock::now()) const {
+		return !empty() && now - oldest_ >= max_delay_;
+	}
+
+	// Calls commit() if due(), otherwise does nothing.
+	error_or<void> flush_if_due(Modbus::timeout_t timeout) {
+		if (due()) return commit(timeout);
+		return {};
+	}
+
+	// Send all dirty registers and coils.
+	// Stops at the first error. Writes that were not sent stay dirty, and
+	// are retried on the next commit.
+	error_or<void> commit(Modbus::timeout_t timeout);
+
+	// Commit, and then read holding registers from the given slave.
+	// If registers of that slave are dirty, the last run of them (up to 121
+	// registers) is sent together with the read as a single
+	// read_write_registers (0x17) transaction, saving a round trip.
+	error_or<void> commit_and_read(
+		byte_t slave_id,
+		uint16_t address,
+		range<uint16_t> values,
+		Modbus::timeout_t timeout
+	);
+
+	// Forget all unflushed writes.
+	void clear() { slaves_.clear(); }
+
+private:
+	struct masked_bits {
+		uint16_t mask;
+		uint16_t value;
+	};
+
+	struct slave_state {
+		std::map<uint16_t, uint16_t> registers;
+		std::map<uint16_t, bool> coils;
+		std::map<uint16_t, masked_bits> bits;
+		bool empty() const { return registers.empty() && coils.empty() && bits.empty(); }
+	};
+
+	Modbus & bus_;
+	clock::duration max_delay_;
+	clock::time_point oldest_;
+	std::map<byte_t, slave_state> slaves_;
+	std::bitset<256> no_mask_write_;
+	std::bitset<256> no_read_write_;
+
+	slave_state & dirty(byte_t slave_id);
+
+	error_or<void> commit_registers(byte_t slave_id, slave_state &, Modbus::timeout_t);
+	error_or<void> commit_coils(byte_t slave_id, slave_state &, Modbus::timeout_t);
+	error_or<void> commit_bits(byte_t slave_id, slave_state &, Modbus::timeout_t);
+
+};
+
+}
@@ -0,0 +1,56 @@
+#include <cstddef>
+
+#include <mstd/range.hpp>
+
+#include <modbus/ascii.hpp>
+
+namespace Modbus {
+
+namespace {
+
+struct hex_tables {
+	char encode[256][2];
+	// The value of the hex digit, or 0x10 for anything else.
+	unsigned char decode[256];
+};
+
+constexpr hex_tables make_hex_tables() {
+	hex_tables t{};
+	char const digits[] = "0123456789ABCDEF";
+	for (int i = 0; i < 256; ++i) {
+		t.encode[i][0] = digits[i >> 4];
+		t.encode[i][1] = digits[i & 0xF];
+		t.decode[i] = 0x10;
+	}
+	for (int i = 0; i < 10; ++i) t.decode['0' + i] = i;
+	for (int i = 0; i < 6; ++i) t.decode['A' + i] = t.decode['a' + i] = 10 + i;
+	return t;
+}
+
+constexpr hex_tables tables = make_hex_tables();
+
+}
+
+char * hex_encode(mstd::range<unsigned char const> in, char * out) {
+	for (unsigned char b : in) {
+		*out++ = tables.encode[b][0];
+		*out++ = tables.encode[b][1];
+	}
+	return out;
+}
+
+bool hex_decode(mstd::range<char const> in, unsigned char * out) {
+	if (in.size() % 2) return false;
+	// Invalid characters are only checked for once, at the end.
+	unsigned char invalid = 0;
+	std::size_t n = in.size() / 2;
+	for (std::size_t i = 0; i < n; ++i) {
+		unsigned char high = tables.decode[(unsigned char)in[2 * i]];
+		unsigned char low = tables.decode[(unsigned char)in[2 * i + 1]];
+		invalid |= high | low;
+		out[i] = high << 4 | (low & 0xF);
+	}
+	return !(invalid & 0x10);
+}
+
+}
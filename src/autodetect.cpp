@@ -0,0 +1,174 @@
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <mstd/error_or.hpp>
+#include <mstd/range.hpp>
+#include <serial/serial.hpp>
+
+#include <modbus/autodetect.hpp>
+#include <modbus/error.hpp>
+#include <modbus/modbus.hpp>
+#include <modbus/serial.hpp>
+#include <modbus/serial_rtu.hpp>
+
+#include "util.hpp"
+
+namespace Modbus {
+
+using detail::answered;
+using detail::file_ptr;
+using detail::last_error;
+
+namespace {
+
+// Throw away whatever arrived at the previous settings.
+void discard_input(Serial::Port & port) {
+	for (int i = 0; i < 1024; ++i) {
+		auto r = port.read(std::chrono::milliseconds(0));
+		if (!r.ok() || !r.value()) break;
+	}
+}
+
+}
+
+std::vector<SerialSettings> likely_serial_settings() {
+	static unsigned int const baud_rates[] = {19200, 9600, 38400, 115200, 57600, 4800, 2400, 1200};
+	static Serial::Parity const parities[] = {Serial::Parity::even, Serial::Parity::none, Serial::Parity::odd};
+	std::vector<SerialSettings> r;
+	for (auto baud_rate : baud_rates) {
+		for (auto parity : parities) {
+			SerialSettings s;
+			s.baud_rate = baud_rate;
+			s.parity = parity;
+			s.stop_bits = Serial::StopBits::one;
+			r.push_back(s);
+		}
+	}
+	// A receiver expecting one stop bit also accepts two, so these are only
+	// needed for slaves that are strict about receiving two.
+	for (auto baud_rate : baud_rates) {
+		SerialSettings s;
+		s.baud_rate = baud_rate;
+		s.parity = Serial::Parity::none;
+		s.stop_bits = Serial::StopBits::two;
+		r.push_back(s);
+	}
+	return r;
+}
+
+error_or<line_config> autodetect(ModbusSerialRtu & bus, autodetect_options const & options) {
+	std::array<uint16_t, 1> value;
+	for (auto const & settings : options.candidates) {
+		// Settings the port doesn't support are skipped.
+		if (bus.configure(settings).error()) continue;
+		discard_input(bus.port());
+		auto timeout = settings.first_byte_timeout(8, options.processing);
+		for (byte_t slave_id : options.slave_ids) {
+			unsigned int n = 0;
+			// Different addresses make different frames, and so different
+			// parity bits.
+			while (n < options.confirmations && answered(bus.read_holding_registers(slave_id, n, value, timeout).error())) ++n;
+			if (n == options.confirmations) {
+				line_config r;
+				r.settings = settings;
+				r.slave_id = slave_id;
+				return r;
+			}
+			// Don't let a late or garbled response disturb the next probe.
+			if (n) discard_input(bus.port());
+		}
+	}
+	return std::error_code(Error::timeout);
+}
+
+std::vector<error_or<line_config>> autodetect_ports(range<std::string const> ports, autodetect_options const & options) {
+	std::vector<error_or<line_config>> results(ports.size());
+	std::vector<std::thread> threads;
+	threads.reserve(ports.size());
+	for (std::size_t i = 0; i < ports.size(); ++i) {
+		threads.emplace_back([&, i] {
+			Serial::Port port;
+			if (auto e = port.open(ports[i]).error()) {
+				results[i] = e;
+				return;
+			}
+			// autodetect() configures the port for every candidate.
+			ModbusSerialRtu bus(std::move(port));
+			auto r = autodetect(bus, options);
+			if (r) r->port = ports[i];
+			results[i] = std::move(r);
+		});
+	}
+	for (auto & t : threads) t.join();
+	return results;
+}
+
+std::string format_serial_settings(SerialSettings const & settings) {
+	char parity = settings.parity == Serial::Parity::even ? 'E' : settings.parity == Serial::Parity::odd ? 'O' : 'N';
+	char stop_bits = settings.stop_bits == Serial::StopBits::two ? '2' : '1';
+	return std::to_string(settings.baud_rate) + parity + stop_bits;
+}
+
+error_or<SerialSettings> parse_serial_settings(char const * s) {
+	auto invalid = std::make_error_code(std::errc::invalid_argument);
+	SerialSettings settings;
+	char * a;
+	unsigned long baud_rate = std::strtoul(s, &a, 10);
+	if (a == s || baud_rate == 0) return invalid;
+	settings.baud_rate = baud_rate;
+	if (*a == 'N') settings.parity = Serial::Parity::none;
+	else if (*a == '\0' || *a == 'E') settings.parity = Serial::Parity::even;
+	else if (*a == 'O') settings.parity = Serial::Parity::odd;
+	else return invalid;
+	if (*a) ++a;
+	if (a[0] == '\0' || (a[0] == '1' && a[1] == '\0')) settings.stop_bits = Serial::StopBits::one;
+	else if (a[0] == '2' && a[1] == '\0') settings.stop_bits = Serial::StopBits::two;
+	else return invalid;
+	return settings;
+}
+
+error_or<void> save_line_configs(char const * file_name, range<line_config const> lines) {
+	file_ptr f(std::fopen(file_name, "w"));
+	if (!f) return last_error();
+	std::fputs("# port settings slave\n", f.get());
+	for (auto const & l : lines) {
+		std::fprintf(f.get(), "%s %s %u\n", l.port.c_str(), format_serial_settings(l.settings).c_str(), l.slave_id);
+	}
+	if (std::fflush(f.get()) != 0) return last_error();
+	return {};
+}
+
+error_or<std::vector<line_config>> load_line_configs(char const * file_name) {
+	file_ptr f(std::fopen(file_name, "r"));
+	if (!f) return last_error();
+	std::vector<line_config> lines;
+	char line[1024];
+	while (std::fgets(line, sizeof(line), f.get())) {
+		if (line[0] == '#' || line[0] == '\n') continue;
+		char * port = std::strtok(line, " \t\n");
+		char * settings = std::strtok(nullptr, " \t\n");
+		char * slave = std::strtok(nullptr, " \t\n");
+		if (!port) continue;
+		if (!settings || !slave) return std::make_error_code(std::errc::invalid_argument);
+		line_config l;
+		l.port = port;
+		auto s = parse_serial_settings(settings);
+		if (!s) return s.error();
+		l.settings = *s;
+		char * end;
+		unsigned long id = std::strtoul(slave, &end, 10);
+		if (*end || id > 255) return std::make_error_code(std::errc::invalid_argument);
+		l.slave_id = id;
+		lines.push_back(l);
+	}
+	if (std::ferror(f.get())) return last_error();
+	return lines;
+}
+
+}
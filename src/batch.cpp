@@ -0,0 +1,149 @@
+#include <algorithm>
+#include <bitset>
+#include <cstddef>
+#include <system_error>
+
+#include <mstd/error_or.hpp>
+#include <mstd/range.hpp>
+
+#include <modbus/batch.hpp>
+#include <modbus/error.hpp>
+#include <modbus/modbus.hpp>
+
+namespace Modbus {
+
+Batch::item_t Batch::add(
+	byte_t slave_id,
+	byte_t function_code,
+	uint16_t address,
+	uint16_t count,
+	uint16_t write_address,
+	uint16_t write_count
+) {
+	std::size_t offset = values_.size();
+	std::size_t n_values = function_code == 0x16 ? 0 : count + write_count;
+	values_.resize(offset + n_values);
+	items_.push_back({slave_id, function_code, address, count, write_address, write_count, offset});
+	results_.push_back(std::error_code(Error::timeout));
+	return items_.size() - 1;
+}
+
+Batch::item_t Batch::write_coils(byte_t slave_id, uint16_t address, range<bool const> values) {
+	item_t i = add(slave_id, 0x0F, address, values.size(), 0, 0);
+	std::copy(values.begin(), values.end(), this->values(i).begin());
+	return i;
+}
+
+Batch::item_t Batch::write_coils(byte_t slave_id, uint16_t address, range<uint16_t const> values) {
+	item_t i = add(slave_id, 0x0F, address, values.size(), 0, 0);
+	std::copy(values.begin(), values.end(), this->values(i).begin());
+	return i;
+}
+
+Batch::item_t Batch::write_registers(byte_t slave_id, uint16_t address, range<uint16_t const> values) {
+	item_t i = add(slave_id, 0x10, address, values.size(), 0, 0);
+	std::copy(values.begin(), values.end(), this->values(i).begin());
+	return i;
+}
+
+Batch::item_t Batch::mask_write_register(byte_t slave_id, uint16_t address, uint16_t and_mask, uint16_t or_mask) {
+	return add(slave_id, 0x16, address, 0, and_mask, or_mask);
+}
+
+Batch::item_t Batch::read_write_registers(
+	byte_t slave_id,
+	uint16_t write_address,
+	range<uint16_t const> write_values,
+	uint16_t read_address,
+	uint16_t read_count
+) {
+	item_t i = add(slave_id, 0x17, read_address, read_count, write_address, write_values.size());
+	std::copy(write_values.begin(), write_values.end(), this->write_values(i).begin());
+	return i;
+}
+
+error_or<void> Batch::run(Modbus & bus, item const & t, Modbus::timeout_t timeout) {
+	bool broadcast = t.slave_id == 0;
+	if (t.function_code == 0x16) {
+		// No values: the masks are in the item itself.
+		auto r = bus.mask_write_register(t.slave_id, t.address, t.write_address, t.write_count, broadcast ? Modbus::timeout_t(0) : timeout);
+		if (broadcast && r.error() == std::error_code(Error::timeout)) return {};
+		return r;
+	}
+	range<uint16_t> v(values_.data() + t.offset, t.count);
+	switch (t.function_code) {
+		case 0x01: return bus.read_coils(t.slave_id, t.address, v, timeout);
+		case 0x02: return bus.read_inputs(t.slave_id, t.address, v, timeout);
+		case 0x03: return bus.read_holding_registers(t.slave_id, t.address, v, timeout);
+		case 0x04: return bus.read_input_registers(t.slave_id, t.address, v, timeout);
+		case 0x0F:
+			if (broadcast) return bus.broadcast_write_coils(t.address, v);
+			return bus.write_coils(t.slave_id, t.address, v, timeout);
+		case 0x10:
+			if (broadcast) return bus.broadcast_write_registers(t.address, v);
+			return bus.write_registers(t.slave_id, t.address, v, timeout);
+		case 0x17: {
+			range<uint16_t const> w(values_.data() + t.offset + t.count, t.write_count);
+			return bus.read_write_registers(t.slave_id, t.write_address, w, t.address, v, timeout);
+		}
+	}
+	return std::error_code(Error::illegal_function);
+}
+
+bool Batch::fusable(std::size_t i) const {
+	if (i + 1 >= items_.size()) return false;
+	auto const & w = items_[i];
+	auto const & r = items_[i + 1];
+	return w.function_code == 0x10 && r.function_code == 0x03
+		&& w.slave_id == r.slave_id && w.slave_id != 0
+		&& !no_read_write_[w.slave_id]
+		&& w.count >= 1 && w.count <= 121
+		&& r.count >= 1 && r.count <= 125;
+}
+
+error_or<void> Batch::run(Modbus & bus, Modbus::timeout_t timeout, bool skip_after_timeout) {
+	std::bitset<256> timed_out;
+	std::error_code first_error;
+	for (std::size_t i = 0; i < items_.size(); ++i) {
+		auto const & t = items_[i];
+		std::size_t n = 1;
+		if (timed_out[t.slave_id]) {
+			results_[i] = std::error_code(Error::timeout);
+		} else {
+			if (fusable(i)) {
+				auto const & r = items_[i + 1];
+				range<uint16_t const> write_values(values_.data() + t.offset, t.count);
+				range<uint16_t> read_values(values_.data() + r.offset, r.count);
+				results_[i] = bus.read_write_registers(t.slave_id, t.address, write_values, r.address, read_values, timeout);
+				if (results_[i].error() == std::error_code(Error::illegal_function)) {
+					no_read_write_[t.slave_id] = true;
+				} else {
+					results_[i + 1] = results_[i];
+					n = 2;
+				}
+			}
+			if (n == 1) results_[i] = run(bus, t, timeout);
+			if (skip_after_timeout && t.slave_id != 0 && results_[i].error() == std::error_code(Error::timeout)) {
+				timed_out[t.slave_id] = true;
+			}
+		}
+		if (!first_error) first_error = results_[i].error();
+		i += n - 1;
+	}
+	if (first_error) return first_error;
+	return {};
+}
+
+void Batch::clear() {
+	items_.clear();
+	values_.clear();
+	results_.clear();
+}
+
+void Batch::reserve(std::size_t items, std::size_t values) {
+	items_.reserve(items);
+	values_.reserve(values);
+	results_.reserve(items);
+}
+
+}
@@ -0,0 +1,84 @@
+#include <algorithm>
+#include <array>
+#include <system_error>
+#include <vector>
+
+#include <mstd/error_or.hpp>
+#include <mstd/range.hpp>
+
+#include <modbus/broadcast.hpp>
+#include <modbus/error.hpp>
+#include <modbus/modbus.hpp>
+
+namespace Modbus {
+
+namespace {
+
+// Broadcast, then read back from every slave with read(slave_id, buffer),
+// and compare with the values. Mismatches are repaired with
+// write(slave_id).
+template<typename T, std::size_t N, typename Broadcast, typename Read, typename Write>
+std::vector<std::error_code> broadcast_and_verify(
+	range<byte_t const> slave_ids,
+	range<T const> values,
+	Broadcast && broadcast,
+	Read && read,
+	Write && write
+) {
+	std::vector<std::error_code> results(slave_ids.size());
+	if (values.size() > N) {
+		std::fill(results.begin(), results.end(), std::error_code(Error::request_too_large));
+		return results;
+	}
+
+	if (auto e = broadcast().error()) {
+		std::fill(results.begin(), results.end(), e);
+		return results;
+	}
+
+	std::array<T, N> buffer;
+	range<T> read_back{buffer.data(), values.size()};
+	for (std::size_t i = 0; i < slave_ids.size(); ++i) {
+		auto & e = results[i];
+		// Only a read back that shows the values were not written is worth a
+		// retry. Errors (e.g. a timeout) are reported as is.
+		e = read(slave_ids[i], read_back).error();
+		if (e || std::equal(values.begin(), values.end(), read_back.begin())) continue;
+		e = write(slave_ids[i]).error();
+	}
+	return results;
+}
+
+}
+
+std::vector<std::error_code> broadcast_registers(
+	Modbus & bus,
+	range<byte_t const> slave_ids,
+	uint16_t address,
+	range<uint16_t const> values,
+	Modbus::timeout_t timeout
+) {
+	return broadcast_and_verify<uint16_t, 123>(
+		slave_ids, values,
+		[&] { return bus.broadcast_write_registers(address, values); },
+		[&] (byte_t id, range<uint16_t> v) { return bus.read_holding_registers(id, address, v, timeout); },
+		[&] (byte_t id) { return bus.write_registers(id, address, values, timeout); }
+	);
+}
+
+std::vector<std::error_code> broadcast_coils(
+	Modbus & bus,
+	range<byte_t const> slave_ids,
+	uint16_t address,
+	range<bool const> values,
+	Modbus::timeout_t timeout
+) {
+	return broadcast_and_verify<bool, 1968>(
+		slave_ids, values,
+		[&] { return bus.broadcast_write_coils(address, values); },
+		[&] (byte_t id, range<bool> v) { return bus.read_coils(id, address, v, timeout); },
+		[&] (byte_t id) { return bus.write_coils(id, address, values, timeout); }
+	);
+}
+
+}
@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include <modbus/bus_time.hpp>
+#include <modbus/modbus.hpp>
+#include <modbus/serial.hpp>
+
+namespace Modbus {
+
+namespace {
+
+std::size_t bits_bytes(std::size_t n) {
+	return (n + 7) / 8;
+}
+
+}
+
+wire_sizes frame_sizes(planned_transaction const & t, Framing framing) {
+	// Every frame has a slave id, function code and two crc bytes.
+	std::size_t request = 4;
+	std::size_t response = 4;
+	switch (t.function_code) {
+		case 0x01:
+		case 0x02: request += 4; response += 1 + bits_bytes(t.count); break;
+		case 0x03:
+		case 0x04: request += 4; response += 1 + 2 * t.count; break;
+		case 0x05:
+		case 0x06: request += 4; response += 4; break;
+		case 0x0F: request += 5 + bits_bytes(t.count); response += 4; break;
+		case 0x10: request += 5 + 2 * t.count; response += 4; break;
+		case 0x16: request += 6; response += 6; break;
+		case 0x17: request += 9 + 2 * t.write_count; response += 1 + 2 * t.count; break;
+		case 0x18: request += 2; response += 4 + 2 * t.count; break;
+		// Unknown: as small as a read request and its exception response.
+		default: request += 4; response += 1; break;
+	}
+	if (framing == Framing::ascii) {
+		request = 2 * request + 1;
+		response = 2 * response + 1;
+	}
+	if (t.request_size) request = t.request_size;
+	if (t.response_size) response = t.response_size;
+	if (t.slave_id == 0) response = 0;
+	return {request, response};
+}
+
+BusTimeModel::BusTimeModel(
+	SerialSettings settings,
+	Framing framing,
+	std::chrono::microseconds processing,
+	std::chrono::microseconds turnaround,
+	std::chrono::microseconds broadcast_delay
+) :
+	settings_(settings),
+	framing_(framing),
+	processing_(processing),
+	turnaround_(turnaround.count() >= 0 ? turnaround : settings.frame_gap()),
+	broadcast_delay_(broadcast_delay) {}
+
+BusTimeModel::BusTimeModel(ModbusSerial const & bus, std::chrono::microseconds processing)
+	: BusTimeModel(bus.settings(), bus.framing(), processing, bus.turnaround_delay(), bus.broadcast_delay()) {}
+
+transaction_time BusTimeModel::predict(
+	byte_t slave_id,
+	std::size_t request_size,
+	std::size_t response_size,
+	std::chrono::microseconds processing
+) const {
+	transaction_time t;
+	t.request = settings_.transmit_time(request_size);
+	if (slave_id == 0) {
+		// No response. The slaves process the request during the broadcast
+		// delay.
+		t.turnaround = std::max(turnaround_, broadcast_delay_);
+	} else {
+		t.processing = processing.count() >= 0 ? processing : processing_;
+		t.response = settings_.transmit_time(response_size);
+		// An ASCII response ends with its LF, without a silent interval.
+		if (framing_ == Framing::rtu) t.frame_end = settings_.frame_gap();
+		t.turnaround = turnaround_;
+	}
+	return t;
+}
+
+transaction_time BusTimeModel::predict(planned_transaction const & t) const {
+	auto sizes = frame_sizes(t, framing_);
+	return predict(t.slave_id, sizes.request, sizes.response, t.processing);
+}
+
+std::chrono::microseconds BusTimeModel::min_scan_period(range<planned_transaction const> plan) const {
+	std::chrono::microseconds period{0};
+	for (auto const & t : plan) period += predict(t).total();
+	return period;
+}
+
+double BusTimeModel::utilization(range<planned_transaction const> plan, std::chrono::microseconds period) const {
+	if (period.count() <= 0) return 0;
+	return double(min_scan_period(plan).count()) / period.count();
+}
+
+void BusTimeMonitor::add(transaction_info const & info) {
+	if (slaves_.empty()) first_start_ = info.start;
+	last_end_ = std::max(last_end_, info.start + info.duration);
+
+	auto predicted = model_.predict(info.slave_id, info.request_size, info.response_size, model_.default_processing());
+	// The turnaround delay is part of the line time, as in the model.
+	busy_ += info.duration + predicted.turnaround;
+
+	auto & s = slaves_[info.slave_id];
+	++s.transactions;
+	if (info.error) ++s.errors;
+	if (info.response_size == 0) return;
+
+	++s.answered;
+	s.duration += std::chrono::duration_cast<std::chrono::microseconds>(info.duration);
+	s.predicted += predicted.transaction();
+	// The response time is measured from when the request was handed to the
+	// port, so includes transmitting it (and reading back a local echo).
+	auto processing = std::chrono::duration_cast<std::chrono::microseconds>(info.response_time) - predicted.request;
+	s.processing += std::max(processing, std::chrono::microseconds(0));
+}
+
+std::vector<BusTimeMonitor::slave_report> BusTimeMonitor::report() const {
+	std::vector<slave_report> r;
+	for (auto const & i : slaves_) {
+		auto const & s = i.second;
+		unsigned int n = s.answered ? s.answered : 1;
+		r.push_back({i.first, s.transactions, s.errors, s.duration / n, s.predicted / n, s.processing / n});
+	}
+	return r;
+}
+
+double BusTimeMonitor::utilization() const {
+	auto elapsed = last_end_ - first_start_;
+	if (slaves_.empty() || elapsed.count() <= 0) return 0;
+	return double(busy_.count()) / elapsed.count();
+}
+
+void BusTimeMonitor::clear() {
+	slaves_.clear();
+	busy_ = {};
+	last_end_ = {};
+}
+
+}
@@ -0,0 +1,226 @@
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include <mstd/error_or.hpp>
+#include <mstd/range.hpp>
+
+#include <modbus/capabilities.hpp>
+#include <modbus/error.hpp>
+#include <modbus/modbus.hpp>
+#include <modbus/scan.hpp>
+
+#include "util.hpp"
+
+namespace Modbus {
+
+using detail::file_ptr;
+using detail::get16;
+using detail::get32;
+using detail::last_error;
+using detail::put16;
+using detail::put32;
+
+namespace {
+
+// File header: magic, format version (16 bit), number of records (16 bit).
+constexpr char magic[4] = {'M', 'B', 'C', 'C'};
+constexpr unsigned int version = 1;
+constexpr std::size_t header_size = 8;
+
+// Record: slave id, echo, max read registers (16 bit), max read coils
+// (16 bit), two reserved bytes, typical latency in µs (32 bit), and the
+// supported and unsupported function code bitsets (16 bytes each).
+constexpr std::size_t record_size = 44;
+
+constexpr std::size_t max_file_size = header_size + 256 * record_size;
+
+void put_bits(byte_t * p, std::bitset<128> const & bits) {
+	for (unsigned int i = 0; i < 16; ++i) {
+		byte_t b = 0;
+		for (unsigned int j = 0; j < 8; ++j) b |= bits[i * 8 + j] << j;
+		p[i] = b;
+	}
+}
+
+void get_bits(byte_t const * p, std::bitset<128> & bits) {
+	for (unsigned int i = 0; i < 128; ++i) bits[i] = p[i / 8] >> (i % 8) & 1;
+}
+
+// The number of items a request reads, for the function codes that have a
+// size limit in DeviceProfile. Zero for anything else.
+unsigned int read_quantity(byte_t function_code, range<byte_t const> parameters) {
+	if (function_code < 0x01 || function_code > 0x04 || parameters.size() != 4) return 0;
+	return parameters[2] << 8 | parameters[3];
+}
+
+uint16_t & read_limit(DeviceProfile & p, byte_t function_code) {
+	return function_code <= 0x02 ? p.max_read_coils : p.max_read_registers;
+}
+
+}
+
+void CapabilityCache::set(DeviceProfile const & profile) {
+	profiles_[profile.slave_id] = profile;
+	known_[profile.slave_id] = true;
+	changed_ = true;
+}
+
+void CapabilityCache::erase(byte_t slave_id) {
+	profiles_[slave_id] = DeviceProfile();
+	profiles_[slave_id].slave_id = slave_id;
+	known_[slave_id] = false;
+	changed_ = true;
+}
+
+std::error_code CapabilityCache::check(byte_t slave_id, byte_t function_code, range<byte_t const> parameters) const {
+	if (!known_[slave_id]) return {};
+	auto const & p = profiles_[slave_id];
+	if (p.known_unsupported(function_code)) return Error::illegal_function;
+	unsigned int n = read_quantity(function_code, parameters);
+	if (n) {
+		unsigned int limit = function_code <= 0x02 ? p.max_read_coils : p.max_read_registers;
+		if (limit && n > limit) return Error::request_too_large;
+	}
+	return {};
+}
+
+void CapabilityCache::learn(
+	byte_t slave_id,
+	byte_t function_code,
+	range<byte_t const> parameters,
+	std::error_code result,
+	std::chrono::microseconds latency
+) {
+	if (!detail::answered(result)) return;
+	if (function_code >= 128) return;
+
+	auto & p = profiles_[slave_id];
+	known_[slave_id] = true;
+	changed_ = true;
+
+	if (result == std::error_code(Error::illegal_function)) {
+		p.supported[function_code] = false;
+		p.unsupported[function_code] = true;
+		return;
+	}
+
+	p.supported[function_code] = true;
+	p.unsupported[function_code] = false;
+
+	if (unsigned int n = read_quantity(function_code, parameters)) {
+		uint16_t & limit = read_limit(p, function_code);
+		if (!result) {
+			if (limit && n > limit) limit = n;
+		} else if (result == std::error_code(Error::illegal_data_value) && n > 1) {
+			if (!limit || limit >= n) limit = n - 1;
+		}
+	}
+
+	if (!result) {
+		auto & t = p.typical_latency;
+		if (t.count() == 0) t = latency;
+		else t += (latency - t) / 8;
+	}
+}
+
+void CapabilityCache::set_echo(byte_t slave_id, DeviceProfile::Echo echo) {
+	profiles_[slave_id].echo = echo;
+	known_[slave_id] = true;
+	changed_ = true;
+}
+
+error_or<void> CapabilityCache::load(char const * file_name) {
+	file_ptr f(std::fopen(file_name, "rb"));
+	if (!f) return last_error();
+
+	std::array<byte_t, max_file_size + 1> data;
+	std::size_t size = std::fread(data.data(), 1, data.size(), f.get());
+	if (std::ferror(f.get())) return last_error();
+
+	auto invalid = std::make_error_code(std::errc::invalid_argument);
+	if (size < header_size || std::memcmp(data.data(), magic, sizeof(magic)) != 0) return invalid;
+	if (get16(&data[4]) != version) return invalid;
+	std::size_t count = get16(&data[6]);
+	if (count > 256 || size != header_size + count * record_size) return invalid;
+
+	CapabilityCache loaded;
+	for (std::size_t i = 0; i < count; ++i) {
+		byte_t const * r = &data[header_size + i * record_size];
+		if (r[1] > byte_t(DeviceProfile::Echo::local)) return invalid;
+		DeviceProfile & p = loaded.profiles_[r[0]];
+		p.echo = DeviceProfile::Echo(r[1]);
+		p.max_read_registers = get16(r + 2);
+		p.max_read_coils = get16(r + 4);
+		p.typical_latency = std::chrono::microseconds(get32(r + 8));
+		get_bits(r + 12, p.supported);
+		get_bits(r + 28, p.unsupported);
+		loaded.known_[r[0]] = true;
+	}
+
+	*this = loaded;
+	return {};
+}
+
+error_or<void> CapabilityCache::save(char const * file_name) {
+	std::array<byte_t, max_file_size> data;
+	std::size_t count = 0;
+	for (unsigned int id = 0; id < profiles_.size(); ++id) {
+		if (!known_[id]) continue;
+		auto const & p = profiles_[id];
+		byte_t * r = &data[header_size + count++ * record_size];
+		r[0] = id;
+		r[1] = byte_t(p.echo);
+		put16(r + 2, p.max_read_registers);
+		put16(r + 4, p.max_read_coils);
+		put16(r + 6, 0);
+		put32(r + 8, p.typical_latency.count() > 0xFFFFFFFF ? 0xFFFFFFFF : p.typical_latency.count());
+		put_bits(r + 12, p.supported);
+		put_bits(r + 28, p.unsupported);
+	}
+	std::memcpy(data.data(), magic, sizeof(magic));
+	put16(&data[4], version);
+	put16(&data[6], count);
+	std::size_t size = header_size + count * record_size;
+
+	// Write to a temporary file first, such that a crash never leaves a
+	// truncated cache behind.
+	std::string temporary = std::string(file_name) + ".tmp";
+	{
+		file_ptr f(std::fopen(temporary.c_str(), "wb"));
+		if (!f) return last_error();
+		if (std::fwrite(data.data(), 1, size, f.get()) != size || std::fflush(f.get()) != 0) {
+			auto e = last_error();
+			std::remove(temporary.c_str());
+			return e;
+		}
+	}
+	if (std::rename(temporary.c_str(), file_name) != 0) return last_error();
+
+	changed_ = false;
+	return {};
+}
+
+error_or<range<byte_t>> ModbusCapabilityGuard::raw_command(
+	byte_t slave_id,
+	byte_t function_code,
+	range<byte_t const> parameters,
+	range<byte_t> response_buffer,
+	timeout_t timeout
+) {
+	// Broadcasts get no response, so nothing can be learned from them.
+	if (slave_id == 0) return bus_.raw_command(slave_id, function_code, parameters, response_buffer, timeout);
+
+	if (auto e = cache_.check(slave_id, function_code, parameters)) return e;
+
+	auto start = std::chrono::steady_clock::now();
+	auto r = bus_.raw_command(slave_id, function_code, parameters, response_buffer, timeout);
+	auto latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+	cache_.learn(slave_id, function_code, parameters, r.error(), latency);
+	return r;
+}
+
+}
@@ -0,0 +1,49 @@
+#include <chrono>
+
+#include <mstd/error_or.hpp>
+
+#include <modbus/fifo_reader.hpp>
+#include <modbus/modbus.hpp>
+
+namespace Modbus {
+
+error_or<std::size_t> FifoReader::drain() {
+	auto now = std::chrono::steady_clock::now();
+	if (transactions_.load(std::memory_order_relaxed) == 0) first_drain_ = now;
+
+	std::size_t total = 0;
+	while (true) {
+		std::size_t head = head_.load(std::memory_order_relaxed);
+		if (next(head) == tail_.load(std::memory_order_acquire)) break;
+
+		fifo_batch & batch = ring_[head];
+		auto r = bus_.read_fifo_queue(slave_id_, address_, batch.values, timeout_);
+		transactions_.fetch_add(1, std::memory_order_relaxed);
+		if (!r) return r.error();
+
+		std::size_t n = *r;
+		if (n) {
+			batch.time = std::chrono::steady_clock::now();
+			batch.size = n;
+			head_.store(next(head), std::memory_order_release);
+			samples_.fetch_add(n, std::memory_order_relaxed);
+			total += n;
+		}
+
+		// Otherwise, the next read returns the same registers again.
+		if (!read_clears_) break;
+
+		// A full response means more may be queued.
+		if (n < batch.values.size()) break;
+	}
+	return total;
+}
+
+double FifoReader::ingest_rate(std::chrono::steady_clock::time_point now) const {
+	if (transactions_.load(std::memory_order_relaxed) == 0) return 0;
+	std::chrono::duration<double> elapsed = now - first_drain_;
+	if (elapsed.count() <= 0) return 0;
+	return samples_.load(std::memory_order_relaxed) / elapsed.count();
+}
+
+}
@@ -0,0 +1,516 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <mstd/error_or.hpp>
+#include <mstd/range.hpp>
+
+#include <modbus/historian.hpp>
+#include <modbus/modbus.hpp>
+
+#include "util.hpp"
+
+namespace Modbus {
+
+using detail::get16;
+using detail::get32;
+using detail::get64;
+using detail::last_error;
+using detail::put16;
+using detail::put32;
+using detail::put64;
+
+namespace {
+
+// Chunk header:
+//  0: "MBHC"
+//  4: slave id
+//  5: format version
+//  6: address (16 bit)
+//  8: number of registers (16 bit)
+// 10: number of samples (16 bit)
+// 12: payload size (32 bit)
+// 16: first timestamp, µs since the epoch (64 bit)
+// 24: last timestamp (64 bit)
+// 32: for every register: min (16 bit), max (16 bit), and the offset of its
+//     column in the payload (32 bit).
+// The payload starts with the timestamp column, followed by the register
+// columns. Every column starts at a byte boundary.
+constexpr char magic[4] = {'M', 'B', 'H', 'C'};
+constexpr byte_t version = 1;
+constexpr std::size_t fixed_header_size = 32;
+constexpr std::size_t register_header_size = 8;
+
+std::error_code corrupt() {
+	return std::make_error_code(std::errc::bad_message);
+}
+
+// The size of the complete chunks at the start of a file, found by walking
+// the chunk headers.
+error_or<off_t> complete_size(int fd) {
+	struct stat s;
+	if (::fstat(fd, &s) != 0) return last_error();
+	off_t offset = 0;
+	byte_t h[fixed_header_size];
+	while (s.st_size - offset >= off_t(fixed_header_size)) {
+		if (::pread(fd, h, sizeof(h), offset) != ssize_t(sizeof(h))) return last_error();
+		if (std::memcmp(h, magic, sizeof(magic)) != 0 || h[5] != version) return corrupt();
+		off_t chunk_size = fixed_header_size + get16(h + 8) * register_header_size + get32(h + 12);
+		if (s.st_size - offset < chunk_size) break;
+		offset += chunk_size;
+	}
+	return offset;
+}
+
+std::int64_t to_micros(historian_clock::time_point t) {
+	return std::chrono::duration_cast<std::chrono::microseconds>(t.time_since_epoch()).count();
+}
+
+historian_clock::time_point from_micros(std::int64_t t) {
+	return historian_clock::time_point(std::chrono::duration_cast<historian_clock::duration>(std::chrono::microseconds(t)));
+}
+
+unsigned int leading_zeros16(unsigned int x) {
+	unsigned int n = 0;
+	for (unsigned int bit = 0x8000; bit && !(x & bit); bit >>= 1) ++n;
+	return n;
+}
+
+unsigned int trailing_zeros16(unsigned int x) {
+	unsigned int n = 0;
+	for (unsigned int bit = 1; bit < 0x10000 && !(x & bit); bit <<= 1) ++n;
+	return n;
+}
+
+// Appends bits, most significant first.
+class bit_writer {
+
+	std::vector<byte_t> bytes_;
+	std::uint64_t buffer_ = 0;
+	unsigned int n_ = 0; // Bits in buffer_, always less than 8 between calls.
+
+public:
+	// At most 32 bits at once.
+	void put(std::uint64_t v, unsigned int bits) {
+		buffer_ = buffer_ << bits | (v & ((std::uint64_t(1) << bits) - 1));
+		n_ += bits;
+		while (n_ >= 8) {
+			n_ -= 8;
+			bytes_.push_back(buffer_ >> n_);
+		}
+	}
+
+	// Pads the last byte with zeros. Returns the bytes.
+	std::vector<byte_t> const & finish() {
+		if (n_) put(0, 8 - n_);
+		return bytes_;
+	}
+
+	// Keeps the allocated memory.
+	void clear() {
+		bytes_.clear();
+		buffer_ = 0;
+		n_ = 0;
+	}
+
+};
+
+class bit_reader {
+
+	byte_t const * p_;
+	byte_t const * end_;
+	unsigned int bit_ = 0; // Next bit in *p_, counted from the most significant.
+
+public:
+	bool overflow = false;
+
+	bit_reader(byte_t const * begin, byte_t const * end) : p_(begin), end_(end) {}
+
+	// At most 32 bits at once.
+	std::uint64_t get(unsigned int bits) {
+		std::uint64_t v = 0;
+		while (bits) {
+			if (p_ == end_) {
+				overflow = true;
+				return 0;
+			}
+			unsigned int available = 8 - bit_;
+			unsigned int n = std::min(available, bits);
+			v = v << n | (*p_ >> (available - n) & ((1u << n) - 1));
+			bits -= n;
+			bit_ += n;
+			if (bit_ == 8) {
+				bit_ = 0;
+				++p_;
+			}
+		}
+		return v;
+	}
+
+};
+
+// Timestamps: the first one in 64 bits, then the difference between
+// consecutive deltas:
+//   0                  '0'
+//   fits in 14 bits    '10'   + 14 bits
+//   fits in 20 bits    '110'  + 20 bits
+//   fits in 32 bits    '1110' + 32 bits
+//   otherwise          '1111' + 64 bits
+bool fits(std::int64_t v, unsigned int bits) {
+	std::int64_t limit = std::int64_t(1) << (bits - 1);
+	return v >= -limit && v < limit;
+}
+
+void put_timestamp_delta(bit_writer & w, std::int64_t dod) {
+	if (dod == 0) {
+		w.put(0, 1);
+	} else if (fits(dod, 14)) {
+		w.put(0b10, 2);
+		w.put(dod, 14);
+	} else if (fits(dod, 20)) {
+		w.put(0b110, 3);
+		w.put(dod, 20);
+	} else if (fits(dod, 32)) {
+		w.put(0b1110, 4);
+		w.put(dod, 32);
+	} else {
+		w.put(0b1111, 4);
+		w.put(std::uint64_t(dod) >> 32, 32);
+		w.put(dod, 32);
+	}
+}
+
+std::int64_t sign_extend(std::uint64_t v, unsigned int bits) {
+	std::uint64_t sign = std::uint64_t(1) << (bits - 1);
+	return std::int64_t((v ^ sign) - sign);
+}
+
+std::int64_t get_timestamp_delta(bit_reader & r) {
+	if (!r.get(1)) return 0;
+	if (!r.get(1)) return sign_extend(r.get(14), 14);
+	if (!r.get(1)) return sign_extend(r.get(20), 20);
+	if (!r.get(1)) return sign_extend(r.get(32), 32);
+	std::uint64_t high = r.get(32);
+	return std::int64_t(high << 32 | r.get(32));
+}
+
+// Register values: the first one in 16 bits, then each XORed with the
+// previous value:
+//   0                              '0'
+//   fits in the previous window    '10' + the bits in the window
+//   otherwise                      '11' + leading zeros (4 bits)
+//                                       + window size - 1 (4 bits)
+//                                       + the bits in the window
+struct xor_window {
+	unsigned int leading = 0;
+	unsigned int size = 0; // Zero if there is no previous window.
+};
+
+void put_value(bit_writer & w, xor_window & window, unsigned int x) {
+	if (x == 0) {
+		w.put(0, 1);
+		return;
+	}
+	unsigned int leading = leading_zeros16(x);
+	unsigned int trailing = trailing_zeros16(x);
+	if (window.size && leading >= window.leading && trailing >= 16 - window.leading - window.size) {
+		w.put(0b10, 2);
+		w.put(x >> (16 - window.leading - window.size), window.size);
+	} else {
+		window.leading = leading;
+		window.size = 16 - leading - trailing;
+		w.put(0b11, 2);
+		w.put(leading, 4);
+		w.put(window.size - 1, 4);
+		w.put(x >> trailing, window.size);
+	}
+}
+
+unsigned int get_value(bit_reader & r, xor_window & window) {
+	if (!r.get(1)) return 0;
+	if (r.get(1)) {
+		window.leading = r.get(4);
+		window.size = r.get(4) + 1;
+		if (window.leading + window.size > 16) {
+			r.overflow = true;
+			return 0;
+		}
+	} else if (!window.size) {
+		r.overflow = true;
+		return 0;
+	}
+	return r.get(window.size) << (16 - window.leading - window.size);
+}
+
+std::uint64_t series_key(byte_t slave_id, uint16_t address, std::size_t count) {
+	return std::uint64_t(slave_id) << 48 | std::uint64_t(address) << 32 | count;
+}
+
+}
+
+struct HistorianWriter::chunk_builder {
+	byte_t slave_id;
+	uint16_t address;
+	std::size_t samples = 0;
+	std::int64_t first_time = 0;
+	std::int64_t last_time = 0;
+	std::int64_t last_delta = 0;
+	bit_writer times;
+
+	struct column {
+		bit_writer bits;
+		xor_window window;
+		uint16_t previous = 0;
+		uint16_t min = 0;
+		uint16_t max = 0;
+	};
+	std::vector<column> columns;
+};
+
+HistorianWriter::HistorianWriter(std::size_t chunk_size)
+	: chunk_size_(std::max<std::size_t>(1, std::min<std::size_t>(chunk_size, 0xFFFF))) {}
+
+HistorianWriter::~HistorianWriter() {
+	flush();
+}
+
+error_or<void> HistorianWriter::open(char const * file_name) {
+	if (file_) {
+		if (auto e = flush().error()) return e;
+	}
+	int fd = ::open(file_name, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+	if (fd < 0) return last_error();
+	auto size = complete_size(fd);
+	if (!size || ::ftruncate(fd, *size) != 0) {
+		auto e = size ? last_error() : size.error();
+		::close(fd);
+		return e;
+	}
+	file_.reset(::fdopen(fd, "ab"));
+	if (!file_) {
+		auto e = last_error();
+		::close(fd);
+		return e;
+	}
+	return {};
+}
+
+error_or<void> HistorianWriter::append(
+	byte_t slave_id,
+	uint16_t address,
+	range<uint16_t const> values,
+	historian_clock::time_point time
+) {
+	if (!file_) return std::make_error_code(std::errc::bad_file_descriptor);
+	if (values.size() == 0 || values.size() > 0xFFFF) return std::make_error_code(std::errc::invalid_argument);
+
+	auto & slot = series_[series_key(slave_id, address, values.size())];
+	if (!slot) {
+		slot.reset(new chunk_builder());
+		slot->slave_id = slave_id;
+		slot->address = address;
+		slot->columns.resize(values.size());
+	}
+	chunk_builder & c = *slot;
+
+	std::int64_t t = to_micros(time);
+	if (c.samples == 0) {
+		c.first_time = t;
+		c.last_delta = 0;
+		c.times.put(std::uint64_t(t) >> 32, 32);
+		c.times.put(t, 32);
+		for (std::size_t i = 0; i < values.size(); ++i) {
+			auto & column = c.columns[i];
+			column.bits.put(values[i], 16);
+			column.window = {};
+			column.previous = column.min = column.max = values[i];
+		}
+	} else {
+		std::int64_t delta = t - c.last_time;
+		put_timestamp_delta(c.times, delta - c.last_delta);
+		c.last_delta = delta;
+		for (std::size_t i = 0; i < values.size(); ++i) {
+			auto & column = c.columns[i];
+			put_value(column.bits, column.window, values[i] ^ column.previous);
+			column.previous = values[i];
+			column.min = std::min(column.min, values[i]);
+			column.max = std::max(column.max, values[i]);
+		}
+	}
+	c.last_time = t;
+
+	if (++c.samples == chunk_size_) return write_chunk(c);
+	return {};
+}
+
+error_or<void> HistorianWriter::write_chunk(chunk_builder & c) {
+	if (c.samples == 0) return {};
+
+	std::size_t count = c.columns.size();
+	std::vector<byte_t> header(fixed_header_size + count * register_header_size);
+
+	auto const & times = c.times.finish();
+	std::size_t payload_size = times.size();
+	for (std::size_t i = 0; i < count; ++i) {
+		auto const & column = c.columns[i];
+		byte_t * r = &header[fixed_header_size + i * register_header_size];
+		put16(r, column.min);
+		put16(r + 2, column.max);
+		put32(r + 4, payload_size);
+		payload_size += c.columns[i].bits.finish().size();
+	}
+
+	std::memcpy(header.data(), magic, sizeof(magic));
+	header[4] = c.slave_id;
+	header[5] = version;
+	put16(&header[6], c.address);
+	put16(&header[8], count);
+	put16(&header[10], c.samples);
+	put32(&header[12], payload_size);
+	put64(&header[16], c.first_time);
+	put64(&header[24], c.last_time);
+
+	bool ok = std::fwrite(header.data(), 1, header.size(), file_.get()) == header.size();
+	ok = ok && std::fwrite(times.data(), 1, times.size(), file_.get()) == times.size();
+	for (auto & column : c.columns) {
+		auto const & bits = column.bits.finish();
+		ok = ok && std::fwrite(bits.data(), 1, bits.size(), file_.get()) == bits.size();
+		column.bits.clear();
+	}
+	c.times.clear();
+	c.samples = 0;
+
+	if (!ok) return last_error();
+	return {};
+}
+
+error_or<void> HistorianWriter::flush() {
+	if (!file_) return {};
+	std::error_code error;
+	for (auto & s : series_) {
+		auto e = write_chunk(*s.second).error();
+		if (!error) error = e;
+	}
+	if (std::fflush(file_.get()) != 0 && !error) error = last_error();
+	if (error) return error;
+	return {};
+}
+
+uint16_t historian_chunk::min(std::size_t i) const {
+	return get16(header + fixed_header_size + i * register_header_size);
+}
+
+uint16_t historian_chunk::max(std::size_t i) const {
+	return get16(header + fixed_header_size + i * register_header_size + 2);
+}
+
+error_or<void> HistorianReader::open(char const * file_name) {
+	close();
+
+	int fd = ::open(file_name, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return last_error();
+	struct stat s;
+	if (::fstat(fd, &s) != 0) {
+		auto e = last_error();
+		::close(fd);
+		return e;
+	}
+	size_ = s.st_size;
+	if (size_) {
+		map_ = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map_ == MAP_FAILED) {
+			auto e = last_error();
+			map_ = nullptr;
+			size_ = 0;
+			::close(fd);
+			return e;
+		}
+	}
+	::close(fd);
+
+	byte_t const * data = static_cast<byte_t const *>(map_);
+	std::size_t offset = 0;
+	while (size_ - offset >= fixed_header_size) {
+		byte_t const * h = data + offset;
+		if (std::memcmp(h, magic, sizeof(magic)) != 0 || h[5] != version) {
+			close();
+			return corrupt();
+		}
+		historian_chunk c;
+		c.slave_id = h[4];
+		c.address = get16(h + 6);
+		c.count = get16(h + 8);
+		c.samples = get16(h + 10);
+		c.payload_size = get32(h + 12);
+		c.first = from_micros(get64(h + 16));
+		c.last = from_micros(get64(h + 24));
+		std::size_t header_size = fixed_header_size + c.count * register_header_size;
+		if (size_ - offset < header_size || size_ - offset - header_size < c.payload_size) break;
+		c.header = h;
+		c.payload = h + header_size;
+		chunks_.push_back(c);
+		offset += header_size + c.payload_size;
+	}
+	return {};
+}
+
+void HistorianReader::close() {
+	if (map_) ::munmap(map_, size_);
+	map_ = nullptr;
+	size_ = 0;
+	chunks_.clear();
+}
+
+error_or<void> HistorianReader::query(
+	historian_query const & q,
+	std::function<void (historian_clock::time_point, uint16_t)> const & f
+) const {
+	std::int64_t from = to_micros(q.from);
+	std::int64_t to = to_micros(q.to);
+
+	for (auto const & c : chunks_) {
+		if (c.slave_id != q.slave_id || q.address < c.address || q.address - c.address >= c.count) continue;
+		if (c.last < q.from || c.first >= q.to) continue;
+		std::size_t i = q.address - c.address;
+		if (c.max(i) < q.min_value || c.min(i) > q.max_value) continue;
+
+		byte_t const * r = c.header + fixed_header_size + i * register_header_size;
+		std::size_t times_end = get32(c.header + fixed_header_size + 4);
+		std::size_t column_begin = get32(r + 4);
+		std::size_t column_end = i + 1 < c.count ? get32(r + register_header_size + 4) : c.payload_size;
+		if (times_end > column_begin || column_begin > column_end || column_end > c.payload_size) return corrupt();
+
+		bit_reader times(c.payload, c.payload + times_end);
+		bit_reader values(c.payload + column_begin, c.payload + column_end);
+
+		std::uint64_t high = times.get(32);
+		std::int64_t t = std::int64_t(high << 32 | times.get(32));
+		std::int64_t delta = 0;
+		unsigned int value = values.get(16);
+		xor_window window;
+
+		for (std::size_t n = 0; n < c.samples; ++n) {
+			if (n) {
+				delta += get_timestamp_delta(times);
+				t += delta;
+				value ^= get_value(values, window);
+			}
+			if (times.overflow || values.overflow) return corrupt();
+			if (t >= from && t < to && value >= q.min_value && value <= q.max_value) {
+				f(from_micros(t), value);
+			}
+		}
+	}
+	return {};
+}
+
+}
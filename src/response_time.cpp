@@ -0,0 +1,47 @@
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include <modbus/response_time.hpp>
+
+namespace Modbus {
+
+constexpr std::size_t ResponseTimeHistogram::n_buckets;
+constexpr std::uint32_t ResponseTimeHistogram::max_samples;
+
+std::size_t ResponseTimeHistogram::bucket(std::uint64_t us) {
+	if (us < 64) return 0;
+	unsigned int log2 = 6;
+	while (us >> (log2 + 1)) ++log2;
+	std::size_t b = (log2 - 6) * 4 + (us >> (log2 - 2) & 3) + 1;
+	return b < n_buckets ? b : n_buckets - 1;
+}
+
+std::uint64_t ResponseTimeHistogram::upper_bound(std::size_t b) {
+	if (b == 0) return 64;
+	unsigned int log2 = (b - 1) / 4 + 6;
+	return std::uint64_t(5 + (b - 1) % 4) << (log2 - 2);
+}
+
+void ResponseTimeHistogram::add(std::chrono::microseconds t) {
+	if (size_ == max_samples) {
+		size_ = 0;
+		for (auto & c : counts_) size_ += c /= 2;
+	}
+	++counts_[bucket(t.count() < 0 ? 0 : t.count())];
+	++size_;
+}
+
+std::chrono::microseconds ResponseTimeHistogram::percentile(double p) const {
+	if (size_ == 0) return std::chrono::microseconds(0);
+	std::uint64_t target = p * size_;
+	if (target >= size_) target = size_ - 1;
+	std::uint64_t seen = 0;
+	for (std::size_t b = 0; b < n_buckets; ++b) {
+		seen += counts_[b];
+		if (seen > target) return std::chrono::microseconds(upper_bound(b));
+	}
+	return std::chrono::microseconds(upper_bound(n_buckets - 1));
+}
+
+}
@@ -0,0 +1,55 @@
+#include <system_error>
+
+#include <fcntl.h>
+#include <linux/serial.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <mstd/error_or.hpp>
+
+#include <modbus/rs485.hpp>
+
+#include "util.hpp"
+
+namespace Modbus {
+
+mstd::error_or<void> enable_rs485(int fd, rs485_settings const & settings) {
+	serial_rs485 config = {};
+	config.flags = SER_RS485_ENABLED;
+	config.flags |= settings.rts_on_send ? SER_RS485_RTS_ON_SEND : SER_RS485_RTS_AFTER_SEND;
+	if (settings.rx_during_tx) config.flags |= SER_RS485_RX_DURING_TX;
+	config.delay_rts_before_send = settings.delay_before_send.count();
+	config.delay_rts_after_send = settings.delay_after_send.count();
+	if (::ioctl(fd, TIOCSRS485, &config) < 0) return detail::last_error();
+	return {};
+}
+
+mstd::error_or<void> disable_rs485(int fd) {
+	serial_rs485 config = {};
+	if (::ioctl(fd, TIOCSRS485, &config) < 0) return detail::last_error();
+	return {};
+}
+
+namespace {
+
+// Call f with a file descriptor of the device, open only for that call.
+template<typename F>
+mstd::error_or<void> with_device(char const * device, F && f) {
+	int fd = ::open(device, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0) return detail::last_error();
+	auto r = f(fd);
+	::close(fd);
+	return r;
+}
+
+}
+
+mstd::error_or<void> enable_rs485(char const * device, rs485_settings const & settings) {
+	return with_device(device, [&] (int fd) { return enable_rs485(fd, settings); });
+}
+
+mstd::error_or<void> disable_rs485(char const * device) {
+	return with_device(device, [] (int fd) { return disable_rs485(fd); });
+}
+
+}
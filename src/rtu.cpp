@@ -0,0 +1,75 @@
+#include <cstddef>
+
+#include <modbus/crc.hpp>
+#include <modbus/error.hpp>
+#include <modbus/modbus.hpp>
+#include <modbus/rtu.hpp>
+
+namespace Modbus {
+
+std::size_t rtu_encode(
+	byte_t slave_id,
+	byte_t function_code,
+	range<byte_t const> parameters,
+	byte_t * out
+) {
+	byte_t * p = out;
+	*p++ = slave_id;
+	*p++ = function_code;
+	for (byte_t b : parameters) *p++ = b;
+	uint16_t crc = crc_ibm({out, p}).get();
+	*p++ = crc & 0xFF;
+	*p++ = crc >> 8;
+	return p - out;
+}
+
+void RtuResponseParser::add(byte_t b) {
+	crc_.add(b);
+	if (size_ == 0) {
+		if (b != slave_id_) is_invalid_response_ = true;
+	} else if (size_ == 1) {
+		if (b == (function_code_ | 0x80)) {
+			is_exception_response_ = true;
+		} else if (b != function_code_) {
+			is_invalid_response_ = true;
+		}
+	} else if (is_exception_response_) {
+		if (size_ == 2) exception_code_ = b;
+	} else if (size_ < 2 + response_buffer_.size()) {
+		response_buffer_[size_ - 2] = b;
+	} else if (size_ >= 4 + response_buffer_.size()) {
+		// Response larger than what fits in response_buffer.
+		is_invalid_response_ = true;
+	}
+	++size_;
+}
+
+error_or<range<byte_t>> RtuResponseParser::result() const {
+	if (size_ == 0) {
+		// No bytes were received.
+		return std::error_code(Error::timeout);
+	}
+
+	if (size_ < 4 || size_ > 256) {
+		// Any valid modbus message is at least four bytes.
+		// Modbus RTU frames may be no longer than 256 bytes.
+		// (1 byte slave id, 2 bytes crc, and 253 PDU.)
+		return std::error_code(Error::bad_frame);
+	}
+
+	if (crc_.get() != 0) {
+		return std::error_code(Error::bad_crc);
+	}
+
+	if (is_invalid_response_ || (is_exception_response_ && size_ != 5)) {
+		return std::error_code(Error::invalid_response);
+	}
+
+	if (is_exception_response_) {
+		return std::error_code(Error(exception_code_));
+	}
+
+	return response_buffer_.subrange(0, size_ - 4);
+}
+
+}
@@ -0,0 +1,164 @@
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <system_error>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <modbus/error.hpp>
+#include <modbus/modbus.hpp>
+#include <modbus/rtu.hpp>
+#include <modbus/rtu_socket.hpp>
+
+#include "util.hpp"
+
+using namespace std::chrono_literals;
+
+namespace Modbus {
+
+using detail::last_error;
+
+namespace {
+
+// Wait until fd is readable. Returns false on timeout.
+error_or<bool> wait_readable(int fd, std::chrono::milliseconds timeout) {
+	pollfd p = {fd, POLLIN, 0};
+	while (true) {
+		int r = ::poll(&p, 1, timeout.count());
+		if (r >= 0) return r > 0;
+		if (errno != EINTR) return last_error();
+	}
+}
+
+}
+
+error_or<void> ModbusRtuSocket::connect(Protocol protocol, char const * host, char const * service) {
+	close();
+
+	addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = protocol == Protocol::tcp ? SOCK_STREAM : SOCK_DGRAM;
+
+	addrinfo * addresses;
+	if (int e = ::getaddrinfo(host, service, &hints, &addresses)) {
+		if (e == EAI_SYSTEM) return last_error();
+		return std::make_error_code(std::errc::host_unreachable);
+	}
+
+	std::error_code error = std::make_error_code(std::errc::host_unreachable);
+	for (addrinfo * a = addresses; a; a = a->ai_next) {
+		int fd = ::socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+		if (fd < 0) {
+			error = last_error();
+			continue;
+		}
+		if (::connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+			error = last_error();
+			::close(fd);
+			continue;
+		}
+		if (protocol == Protocol::tcp) {
+			int one = 1;
+			::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		}
+		fd_ = fd;
+		protocol_ = protocol;
+		break;
+	}
+
+	::freeaddrinfo(addresses);
+
+	if (fd_ < 0) return error;
+	return {};
+}
+
+void ModbusRtuSocket::close() {
+	if (fd_ >= 0) ::close(fd_);
+	fd_ = -1;
+}
+
+void ModbusRtuSocket::discard_pending() {
+	// Late responses to earlier (timed out) requests.
+	std::array<byte_t, 256> buffer;
+	while (::recv(fd_, buffer.data(), buffer.size(), MSG_DONTWAIT) > 0) {}
+}
+
+error_or<range<byte_t>> ModbusRtuSocket::raw_command(
+	byte_t slave_id,
+	byte_t function_code,
+	range<byte_t const> parameters,
+	range<byte_t> response_buffer,
+	timeout_t timeout
+) {
+	if (fd_ < 0) return std::make_error_code(std::errc::not_connected);
+
+	{
+		if (parameters.size() > 252) return std::error_code(Error::request_too_large);
+
+		std::array<byte_t, 256> adu;
+		size_t adu_size = rtu_encode(slave_id, function_code, parameters, adu.data());
+
+		discard_pending();
+
+		size_t sent = 0;
+		while (sent < adu_size) {
+			ssize_t n = ::send(fd_, adu.data() + sent, adu_size - sent, MSG_NOSIGNAL);
+			if (n < 0) {
+				if (errno == EINTR) continue;
+				return last_error();
+			}
+			sent += n;
+		}
+	}
+
+	if (timeout.count() == 0) {
+		// With timeout == 0, we don't expect any response at all.
+		// (For example, for a broadcast command.)
+		return std::error_code(Error::timeout);
+	}
+
+	RtuResponseParser response(slave_id, function_code, response_buffer);
+
+	// Room for one byte more than the largest frame, to detect oversized datagrams.
+	std::array<byte_t, 257> buffer;
+
+	auto wait = timeout;
+
+	while (!response.complete()) {
+		auto readable = wait_readable(fd_, wait);
+		if (!readable) return readable.error();
+		if (!*readable) break;
+
+		ssize_t n = ::recv(fd_, buffer.data(), buffer.size(), 0);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return last_error();
+		}
+		if (n == 0) return std::make_error_code(std::errc::connection_reset);
+
+		response.add({buffer.data(), size_t(n)});
+
+		if (response.size() > 256) {
+			// RTU frames may be no longer than 256 bytes.
+			return std::error_code(Error::bad_frame);
+		}
+
+		if (response.crc_ok()) {
+			// Most likely a response shorter than the response buffer.
+			if (protocol_ == Protocol::udp) break;
+			wait = 2ms;
+		} else {
+			wait = gap_timeout_;
+		}
+	}
+
+	return response.result();
+}
+
+}
@@ -0,0 +1,139 @@
+#include <array>
+#include <system_error>
+#include <vector>
+
+#include <mstd/error_or.hpp>
+#include <mstd/range.hpp>
+
+#include <modbus/error.hpp>
+#include <modbus/modbus.hpp>
+#include <modbus/scan.hpp>
+
+#include "util.hpp"
+
+namespace Modbus {
+
+using detail::answered;
+
+namespace {
+
+struct probe_request {
+	byte_t function_code;
+	std::size_t size;
+	std::array<byte_t, 9> parameters;
+};
+
+// Binary search for the largest n for which read(n) succeeds.
+//
+// Only Error::illegal_data_value and Error::illegal_data_address, the
+// exceptions for a quantity or range out of bounds, mean that n is too
+// large. Other errors (e.g. a lost frame) are retried, and if they persist,
+// the search is given up, so a bad line doesn't result in a wrong limit.
+// Returns 0 (unknown) if read(1) fails or the search is given up.
+template<typename F>
+uint16_t find_limit(uint16_t limit, F && read) {
+	// 1 if n items can be read, 0 if that is too many, -1 if unknown.
+	auto fits = [&] (uint16_t n) {
+		for (int attempt = 0; attempt < 3; ++attempt) {
+			std::error_code e = read(n);
+			if (!e) return 1;
+			if (e == std::error_code(Error::illegal_data_value)) return 0;
+			if (e == std::error_code(Error::illegal_data_address)) return 0;
+		}
+		return -1;
+	};
+	if (fits(1) != 1) return 0;
+	uint16_t low = 1;
+	uint16_t high = limit;
+	while (low < high) {
+		uint16_t mid = (low + high + 1) / 2;
+		int r = fits(mid);
+		if (r < 0) return 0;
+		if (r) low = mid;
+		else high = mid - 1;
+	}
+	return low;
+}
+
+}
+
+std::vector<byte_t> scan(
+	Modbus & bus,
+	byte_t first_slave_id,
+	byte_t last_slave_id,
+	Modbus::timeout_t timeout,
+	uint16_t address
+) {
+	std::vector<byte_t> found;
+	uint16_t value;
+	for (unsigned int id = first_slave_id; id <= last_slave_id; ++id) {
+		if (answered(bus.read_holding_registers(id, address, value, timeout).error())) {
+			found.push_back(id);
+		}
+	}
+	return found;
+}
+
+DeviceProfile probe(
+	Modbus & bus,
+	byte_t slave_id,
+	Modbus::timeout_t timeout,
+	uint16_t address
+) {
+	DeviceProfile profile;
+	profile.slave_id = slave_id;
+
+	byte_t a_high = address >> 8;
+	byte_t a_low = address & 0xFF;
+
+	probe_request const requests[] = {
+		// Read one item.
+		{0x01, 4, {{a_high, a_low, 0, 1}}},
+		{0x02, 4, {{a_high, a_low, 0, 1}}},
+		{0x03, 4, {{a_high, a_low, 0, 1}}},
+		{0x04, 4, {{a_high, a_low, 0, 1}}},
+		// Write zero coils or registers.
+		{0x0F, 5, {{a_high, a_low, 0, 0, 0}}},
+		{0x10, 5, {{a_high, a_low, 0, 0, 0}}},
+		// File record requests without any groups.
+		{0x14, 1, {{0}}},
+		{0x15, 1, {{0}}},
+		// Read and write zero registers.
+		{0x17, 9, {{a_high, a_low, 0, 0, a_high, a_low, 0, 0, 0}}},
+	};
+
+	std::array<byte_t, 256> response;
+	for (auto const & r : requests) {
+		range<byte_t const> parameters{r.parameters.data(), r.size};
+		auto e = bus.raw_command(slave_id, r.function_code, parameters, response, timeout).error();
+		if (e == std::error_code(Error::illegal_function)) {
+			profile.unsupported[r.function_code] = true;
+		} else if (answered(e)) {
+			profile.supported[r.function_code] = true;
+		}
+	}
+
+	std::array<uint16_t, 125> registers;
+	byte_t register_function = profile.supports(0x03) ? 0x03 : 0x04;
+	if (profile.supports(register_function)) {
+		profile.max_read_registers = find_limit(registers.size(), [&] (uint16_t n) {
+			range<uint16_t> values{registers.data(), n};
+			if (register_function == 0x03) return bus.read_holding_registers(slave_id, address, values, timeout).error();
+			else return bus.read_input_registers(slave_id, address, values, timeout).error();
+		});
+	}
+
+	std::array<unsigned char, 2000> coils;
+	byte_t coil_function = profile.supports(0x01) ? 0x01 : 0x02;
+	if (profile.supports(coil_function)) {
+		profile.max_read_coils = find_limit(coils.size(), [&] (uint16_t n) {
+			range<unsigned char> values{coils.data(), n};
+			if (coil_function == 0x01) return bus.read_coils(slave_id, address, values, timeout).error();
+			else return bus.read_inputs(slave_id, address, values, timeout).error();
+		});
+	}
+
+	return profile;
+}
+
+}
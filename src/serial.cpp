@@ -0,0 +1,66 @@
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include <modbus/modbus.hpp>
+#include <modbus/response_time.hpp>
+#include <modbus/serial.hpp>
+
+namespace Modbus {
+
+std::chrono::milliseconds ModbusSerial::limit_timeout(std::chrono::milliseconds t) const {
+	if (transaction_deadline_.count() == 0) return t;
+	auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline_ - std::chrono::steady_clock::now());
+	if (left.count() < 0) return std::chrono::milliseconds(0);
+	return std::min(t, left);
+}
+
+error_or<range<byte_t>> ModbusSerial::raw_command(
+	byte_t slave_id,
+	byte_t function_code,
+	range<byte_t const> parameters,
+	range<byte_t> response_buffer,
+	timeout_t timeout
+) {
+	auto ready = last_transaction_end_ + turnaround_delay();
+	if (last_broadcast_time_.count() >= 0) {
+		ready = std::max(ready, last_transaction_end_ + last_broadcast_time_ + broadcast_delay());
+	}
+	if (std::chrono::steady_clock::now() < ready) std::this_thread::sleep_until(ready);
+
+	auto histogram = response_times_.find(slave_id);
+
+	if (adaptive_timeout_ && timeout.count() && histogram != response_times_.end()) {
+		auto const & a = adaptive_timeout_settings_;
+		if (histogram->second.size() >= a.min_samples) {
+			auto learned = std::chrono::duration_cast<std::chrono::milliseconds>(histogram->second.percentile(a.percentile));
+			// The timeout starts when the request is handed to the port, so
+			// includes transmitting it.
+			learned += std::chrono::duration_cast<std::chrono::milliseconds>(settings_.transmit_time(request_size(parameters.size())));
+			learned += std::chrono::milliseconds(1) + a.margin;
+			timeout = std::min(timeout, std::max(a.floor, std::min(a.ceiling, learned)));
+		}
+	}
+
+	transaction_info info{slave_id, function_code, 0, 0, {}, std::chrono::steady_clock::now(), {}, {}};
+	deadline_ = info.start + transaction_deadline_;
+	auto r = serial_command(slave_id, function_code, parameters, response_buffer, limit_timeout(timeout), info);
+	last_transaction_end_ = std::chrono::steady_clock::now();
+	last_broadcast_time_ = std::chrono::microseconds(-1);
+	if (slave_id == 0) last_broadcast_time_ = settings_.transmit_time(info.request_size);
+
+	if (info.response_size) {
+		if (histogram == response_times_.end()) histogram = response_times_.emplace(slave_id, ResponseTimeHistogram()).first;
+		auto processing = std::chrono::duration_cast<std::chrono::microseconds>(info.response_time) - settings_.transmit_time(info.request_size);
+		histogram->second.add(std::max(processing, std::chrono::microseconds(0)));
+	}
+
+	if (transaction_hook_) {
+		info.error = r.error();
+		info.duration = last_transaction_end_ - info.start;
+		transaction_hook_(info);
+	}
+	return r;
+}
+
+}
@@ -0,0 +1,124 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+
+#include <modbus/ascii.hpp>
+#include <modbus/error.hpp>
+#include <modbus/modbus.hpp>
+#include <modbus/serial.hpp>
+#include <modbus/serial_ascii.hpp>
+
+namespace Modbus {
+
+error_or<range<byte_t>> ModbusSerialAscii::serial_command(
+	byte_t slave_id,
+	byte_t function_code,
+	range<byte_t const> parameters,
+	range<byte_t> response_buffer,
+	std::chrono::milliseconds timeout,
+	transaction_info & info
+) {
+	// Frame: ':', hex encoded slave id, PDU and LRC, CR, LF.
+	// The PDU is at most 253 bytes, so a frame is at most 513 characters.
+	std::array<char, 513> frame;
+
+	{
+		if (parameters.size() > 252) return std::error_code(Error::request_too_large);
+
+		std::array<byte_t, 2> header = {{slave_id, function_code}};
+		byte_t check = lrc().add(header).add(parameters).get();
+
+		char * p = frame.data();
+		*p++ = ':';
+		p = hex_encode(header, p);
+		p = hex_encode(parameters, p);
+		p = hex_encode(check, p);
+		*p++ = '\r';
+		*p++ = '\n';
+
+		for (char c : range<char const>(frame.data(), p)) {
+			if (auto e = port_.write(byte_t(c)).error()) return e;
+		}
+		info.request_size = p - frame.data();
+	}
+
+	if (timeout.count() == 0) {
+		// With timeout == 0, we don't expect any response at all.
+		// (For example, for a broadcast command.)
+		return std::error_code(Error::timeout);
+	}
+
+	// Read everything up to LF. Anything before the last ':' is ignored.
+	bool started = false;
+	bool complete = false;
+	size_t n = 0;
+	size_t read_i = 0;
+
+	auto request_end = std::chrono::steady_clock::now();
+	auto read = port_.read(limit_timeout(timeout));
+	if (read.ok() && read.value()) info.response_time = std::chrono::steady_clock::now() - request_end;
+
+	for (; read.ok() && read.value(); read = port_.read(limit_timeout(character_timeout_)), ++read_i) {
+		char c = *read.value();
+		if (c == ':') {
+			started = true;
+			n = 0;
+		} else if (!started) {
+			continue;
+		} else if (c == '\n') {
+			complete = true;
+			++read_i;
+			break;
+		} else if (n == frame.size()) {
+			return std::error_code(Error::bad_frame);
+		} else {
+			frame[n++] = c;
+		}
+	}
+
+	info.response_size = read_i;
+
+	if (read.error()) return read.error();
+
+	if (read_i == 0 || (!complete && past_deadline())) {
+		// No characters were read before the first timeout, or the
+		// transaction deadline passed.
+		return std::error_code(Error::timeout);
+	}
+
+	// The frame must end in CR LF, and contain at least the slave id,
+	// function code and LRC.
+	if (!complete || n < 7 || frame[n - 1] != '\r' || n % 2 != 1) {
+		return std::error_code(Error::bad_frame);
+	}
+
+	std::array<byte_t, 256> adu;
+	size_t adu_size = n / 2;
+	if (!hex_decode({frame.data(), n - 1}, adu.data())) {
+		return std::error_code(Error::bad_frame);
+	}
+
+	if (lrc({adu.data(), adu_size}).get() != 0) {
+		return std::error_code(Error::bad_crc);
+	}
+
+	if (adu[0] != slave_id) {
+		return std::error_code(Error::invalid_response);
+	}
+
+	if (adu[1] == (function_code | 0x80)) {
+		if (adu_size != 4) return std::error_code(Error::invalid_response);
+		return std::error_code(Error(adu[2]));
+	}
+
+	size_t data_size = adu_size - 3;
+
+	if (adu[1] != function_code || data_size > response_buffer.size()) {
+		return std::error_code(Error::invalid_response);
+	}
+
+	std::copy(&adu[2], &adu[2] + data_size, response_buffer.begin());
+	return response_buffer.subrange(0, data_size);
+}
+
+}
@@ -1,33 +1,54 @@
+#include <array>
 #include <chrono>
 
-#include <modbus/crc.hpp>
 #include <modbus/error.hpp>
 #include <modbus/modbus.hpp>
+#include <modbus/rtu.hpp>
+#include <modbus/serial.hpp>
 #include <modbus/serial_rtu.hpp>
 
+#include "util.hpp"
+
 using namespace std::chrono_literals;
 
 namespace Modbus {
 
-error_or<range<byte_t>> ModbusSerialRtu::raw_command(
+error_or<range<byte_t>> ModbusSerialRtu::serial_command(
 	byte_t slave_id,
 	byte_t function_code,
 	range<byte_t const> parameters,
 	range<byte_t> response_buffer,
-	std::chrono::milliseconds timeout
+	std::chrono::milliseconds timeout,
+	transaction_info & info
 ) {
+	std::chrono::steady_clock::time_point request_end;
+
 	{
-		uint16_t crc = crc_ibm().add(slave_id).add(function_code).add(parameters).get();
-		unsigned char crc_low = crc & 0xFF;
-		unsigned char crc_high = crc >> 8;
+		if (parameters.size() > 252) return std::error_code(Error::request_too_large);
 
-		range<byte_t const> to_write[] = {
-			slave_id, function_code, parameters, crc_low, crc_high
-		};
+		std::array<byte_t, 256> adu;
+		size_t adu_size = rtu_encode(slave_id, function_code, parameters, adu.data());
 
-		for (auto r : to_write) {
-			for (byte_t b : r) {
-				if (auto e = port_.write(b).error()) return e;
+		for (size_t i = 0; i < adu_size; ++i) {
+			if (auto e = port_.write(adu[i]).error()) return e;
+		}
+		info.request_size = adu_size;
+		// The response time is measured from here also with a local echo,
+		// so it includes transmitting the request (during which the echo
+		// arrives) either way.
+		request_end = std::chrono::steady_clock::now();
+
+		if (local_echo_) {
+			// The echo arrives while the request is being transmitted.
+			auto transmit_time = std::chrono::duration_cast<std::chrono::milliseconds>(settings_.transmit_time(adu_size));
+			auto read = port_.read(limit_timeout(transmit_time + 20ms));
+			for (size_t i = 0; i < adu_size; read = port_.read(limit_timeout(20ms))) {
+				if (read.error()) return read.error();
+				// A missing or corrupted echo means the request itself
+				// probably did not make it to the line intact.
+				if (!read.value() && past_deadline()) return std::error_code(Error::timeout);
+				if (!read.value() || *read.value() != adu[i]) return std::error_code(Error::bad_frame);
+				if (++i == adu_size) break;
 			}
 		}
 	}
@@ -38,63 +59,45 @@ error_or<range<byte_t>> ModbusSerialRtu::raw_command(
 		return std::error_code(Error::timeout);
 	}
 
-	crc_ibm crc;
-
-	bool is_invalid_response = false;
-	bool is_exception_response = false;
-	unsigned char exception_code;
-
-	auto read = port_.read(timeout);
-	size_t read_i = 0;
-
-	for (; read.ok() && read.value(); read = port_.read(read_i == response_buffer.size() + 4 ? 2ms : 20ms), ++read_i) {
-		crc.add(*read.value());
-		if (read_i == 0) {
-			if (read.value() != slave_id) is_invalid_response = true;
-		} else if (read_i == 1) {
-			if (*read.value() == (function_code | 0x80)) {
-				is_exception_response = true;
-				response_buffer = exception_code;
-			} else if (read.value() != function_code) {
-				is_invalid_response = true;
-			}
-		} else if (read_i >= 2 && read_i < 2 + response_buffer.size()) {
-			response_buffer[read_i - 2] = *read.value();
-		} else if (read_i > 255) {
+	RtuResponseParser response(slave_id, function_code, response_buffer);
+
+	auto read = port_.read(limit_timeout(timeout));
+	if (read.ok() && read.value()) info.response_time = std::chrono::steady_clock::now() - request_end;
+
+	for (; read.ok() && read.value(); read = port_.read(limit_timeout(response.size() == response.expected_size() ? 2ms : 20ms))) {
+		response.add(*read.value());
+		if (response.size() > 256) {
 			// Modbus serial RTU frames may be no longer than 256 bytes.
 			// (1 byte slave id, 2 bytes crc, and 253 PDU.)
 			return std::error_code(Error::bad_frame);
-		} else if (read_i >= 4 + response_buffer.size()) {
-			// Response larger than what fits in response_buffer.
-			is_invalid_response = true;
 		}
 	}
 
-	if (read.error()) return read.error();
+	info.response_size = response.size();
 
-	if (read_i == 0) {
-		// No bytes were read before the first timeout.
-		return std::error_code(Error::timeout);
-	}
-
-	if (read_i < 4) {
-		// Any valid modbus message is at least four bytes.
-		return std::error_code(Error::bad_frame);
-	}
+	if (read.error()) return read.error();
 
-	if (crc.get() != 0) {
-		return std::error_code(Error::bad_crc);
-	}
+	if (past_deadline() && !response.complete()) return std::error_code(Error::timeout);
 
-	if (is_invalid_response || (is_exception_response && read_i != 5)) {
-		return std::error_code(Error::invalid_response);
-	}
+	return response.result();
+}
 
-	if (is_exception_response) {
-		return std::error_code(Error(exception_code));
+error_or<bool> ModbusSerialRtu::detect_echo(byte_t slave_id, timeout_t timeout, uint16_t address) {
+	bool echo = local_echo_;
+	uint16_t value;
+	error_or<bool> result = std::error_code(Error::timeout);
+	for (bool e : {false, true}) {
+		local_echo_ = e;
+		auto error = read_holding_registers(slave_id, address, value, timeout).error();
+		// Any valid frame counts, including exception responses.
+		if (detail::answered(error)) {
+			result = e;
+			break;
+		}
+		result = error;
 	}
-
-	return response_buffer.subrange(0, read_i - 4);
+	local_echo_ = echo;
+	return result;
 }
 
 }
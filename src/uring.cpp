@@ -0,0 +1,267 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <memory>
+#include <system_error>
+
+#include <liburing.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <mstd/error_or.hpp>
+#include <mstd/range.hpp>
+
+#include <modbus/error.hpp>
+#include <modbus/modbus.hpp>
+#include <modbus/rtu.hpp>
+#include <modbus/uring.hpp>
+
+namespace Modbus {
+
+namespace {
+
+// Every line has a slice of the registered buffer: the request, followed by
+// the response. The response part has room for one byte more than the
+// largest frame, to detect oversized responses.
+constexpr std::size_t request_capacity = 256;
+constexpr std::size_t response_capacity = 257;
+constexpr std::size_t line_buffer_size = 576; // Rounded up to whole cache lines.
+
+// Read and write at the current position, as for a serial port or socket.
+constexpr std::uint64_t no_offset = std::uint64_t(-1);
+
+std::error_code system_error(int e) {
+	return std::error_code(e, std::generic_category());
+}
+
+// Read and drop whatever input is waiting, without blocking.
+void discard_input(int fd) {
+	byte_t buffer[256];
+	pollfd p = {fd, POLLIN, 0};
+	while (::poll(&p, 1, 0) > 0 && (p.revents & POLLIN) && ::read(fd, buffer, sizeof(buffer)) > 0) {}
+}
+
+__kernel_timespec to_timespec(std::chrono::microseconds t) {
+	__kernel_timespec ts;
+	ts.tv_sec = t.count() / 1000000;
+	ts.tv_nsec = t.count() % 1000000 * 1000;
+	return ts;
+}
+
+}
+
+struct UringEngine::line {
+	int fd;
+	uring_line_timing timing;
+	byte_t * request;
+	byte_t * response;
+
+	enum class state_t { idle, writing, reading };
+	state_t state = state_t::idle;
+	// The last transaction did not end cleanly, so unread (late) response
+	// bytes may be waiting.
+	bool stale = false;
+
+	std::size_t request_size = 0;
+	std::size_t written = 0;
+	Modbus::timeout_t timeout{0};
+	RtuResponseParser parser;
+	// Must stay valid until the linked timeout is submitted.
+	__kernel_timespec timeout_spec;
+	callback done;
+
+	line(int fd, uring_line_timing timing, byte_t * buffer)
+		: fd(fd), timing(timing), request(buffer), response(buffer + request_capacity),
+		  parser(0, 0, range<byte_t>(response, response)) {}
+};
+
+UringEngine::UringEngine() {}
+
+UringEngine::~UringEngine() {
+	if (ring_) io_uring_queue_exit(ring_.get());
+}
+
+error_or<void> UringEngine::init(std::size_t max_lines, unsigned int queue_depth) {
+	if (ring_) return std::make_error_code(std::errc::already_connected);
+
+	std::unique_ptr<io_uring> ring(new io_uring());
+	int r = io_uring_queue_init(queue_depth, ring.get(), 0);
+	if (r < 0) return system_error(-r);
+
+	buffers_.assign(max_lines * line_buffer_size, 0);
+	if (max_lines) {
+		iovec buffer = {buffers_.data(), buffers_.size()};
+		r = io_uring_register_buffers(ring.get(), &buffer, 1);
+		if (r < 0) {
+			io_uring_queue_exit(ring.get());
+			buffers_.clear();
+			return system_error(-r);
+		}
+	}
+
+	ring_ = std::move(ring);
+	max_lines_ = max_lines;
+	lines_.reserve(max_lines);
+	return {};
+}
+
+error_or<std::size_t> UringEngine::add_line(int fd, uring_line_timing timing) {
+	if (!ring_) return std::make_error_code(std::errc::not_connected);
+	if (lines_.size() == max_lines_) return std::make_error_code(std::errc::no_buffer_space);
+	byte_t * buffer = &buffers_[lines_.size() * line_buffer_size];
+	lines_.emplace_back(new line(fd, timing, buffer));
+	return lines_.size() - 1;
+}
+
+bool UringEngine::busy(std::size_t line) const {
+	return line < lines_.size() && lines_[line]->state != line::state_t::idle;
+}
+
+error_or<void> UringEngine::start(
+	std::size_t line_index,
+	byte_t slave_id,
+	byte_t function_code,
+	range<byte_t const> parameters,
+	std::size_t response_size,
+	Modbus::timeout_t timeout,
+	callback done
+) {
+	if (line_index >= lines_.size()) return std::make_error_code(std::errc::invalid_argument);
+	line & l = *lines_[line_index];
+	if (l.state != line::state_t::idle) return std::make_error_code(std::errc::device_or_resource_busy);
+	if (parameters.size() > 252 || response_size > 252) return std::error_code(Error::request_too_large);
+
+	if (l.stale) {
+		discard_input(l.fd);
+		l.stale = false;
+	}
+
+	l.request_size = rtu_encode(slave_id, function_code, parameters, l.request);
+	l.written = 0;
+	l.timeout = timeout;
+	// The response data is parsed in place: the parser 'copies' every data
+	// byte onto itself.
+	l.parser = RtuResponseParser(slave_id, function_code, range<byte_t>(l.response + 2, response_size));
+
+	if (auto e = submit_write(l)) return e;
+	l.state = line::state_t::writing;
+	l.done = std::move(done);
+	++pending_;
+	return {};
+}
+
+std::error_code UringEngine::submit_write(line & l) {
+	io_uring_sqe * sqe = io_uring_get_sqe(ring_.get());
+	if (!sqe) {
+		io_uring_submit(ring_.get());
+		sqe = io_uring_get_sqe(ring_.get());
+		if (!sqe) return std::make_error_code(std::errc::resource_unavailable_try_again);
+	}
+	io_uring_prep_write_fixed(sqe, l.fd, l.request + l.written, l.request_size - l.written, no_offset, 0);
+	io_uring_sqe_set_data(sqe, &l);
+	return {};
+}
+
+std::error_code UringEngine::submit_read(line & l, std::chrono::microseconds timeout) {
+	// The read and its linked timeout must be in the same submission.
+	if (io_uring_sq_space_left(ring_.get()) < 2) io_uring_submit(ring_.get());
+	io_uring_sqe * read = io_uring_get_sqe(ring_.get());
+	if (!read) return std::make_error_code(std::errc::resource_unavailable_try_again);
+	io_uring_sqe * link = io_uring_get_sqe(ring_.get());
+	if (!link) {
+		// The first entry is already taken, so submit it as a no-op.
+		io_uring_prep_nop(read);
+		io_uring_sqe_set_data(read, nullptr);
+		return std::make_error_code(std::errc::resource_unavailable_try_again);
+	}
+
+	std::size_t received = l.parser.size();
+	io_uring_prep_read_fixed(read, l.fd, l.response + received, response_capacity - received, no_offset, 0);
+	io_uring_sqe_set_data(read, &l);
+	read->flags |= IOSQE_IO_LINK;
+
+	l.timeout_spec = to_timespec(timeout);
+	io_uring_prep_link_timeout(link, &l.timeout_spec, 0);
+	// Completions of the timeout itself are ignored. When it expires, the
+	// read completes with -ECANCELED.
+	io_uring_sqe_set_data(link, nullptr);
+	return {};
+}
+
+void UringEngine::handle(line & l, int result) {
+	if (l.state == line::state_t::writing) {
+		if (result < 0) return finish(l, system_error(-result));
+		l.written += result;
+		if (l.written < l.request_size) {
+			if (auto e = submit_write(l)) finish(l, e);
+			return;
+		}
+		if (l.timeout.count() == 0) {
+			// With timeout == 0, we don't expect any response at all.
+			// (For example, for a broadcast command.)
+			return finish(l, std::error_code(Error::timeout));
+		}
+		l.state = line::state_t::reading;
+		auto first_byte = std::chrono::duration_cast<std::chrono::microseconds>(l.timeout) + l.timing.character_time * l.request_size;
+		if (auto e = submit_read(l, first_byte)) finish(l, e);
+
+	} else if (l.state == line::state_t::reading) {
+		// The linked timeout expired: no (more) data within the timeout.
+		if (result == -ECANCELED || result == -ETIME) {
+			auto r = l.parser.result();
+			// A late response may still arrive.
+			if (!r) l.stale = true;
+			return finish(l, r);
+		}
+		if (result < 0) {
+			l.stale = true;
+			return finish(l, system_error(-result));
+		}
+		if (result == 0) return finish(l, std::make_error_code(std::errc::connection_reset));
+
+		l.parser.add(range<byte_t const>(l.response + l.parser.size(), std::size_t(result)));
+		if (l.parser.size() > 256) {
+			// RTU frames may be no longer than 256 bytes.
+			l.stale = true;
+			return finish(l, std::error_code(Error::bad_frame));
+		}
+		if (l.parser.complete()) return finish(l, l.parser.result());
+		if (auto e = submit_read(l, l.timing.frame_gap)) finish(l, e);
+	}
+}
+
+void UringEngine::finish(line & l, error_or<range<byte_t>> result) {
+	l.state = line::state_t::idle;
+	--pending_;
+	// The callback may start the next transaction on this line.
+	callback done = std::move(l.done);
+	l.done = nullptr;
+	if (done) done(result);
+}
+
+error_or<void> UringEngine::run_once(std::chrono::milliseconds max_wait) {
+	if (!ring_) return std::make_error_code(std::errc::not_connected);
+
+	int r = io_uring_submit(ring_.get());
+	if (r < 0) return system_error(-r);
+
+	io_uring_cqe * cqe;
+	__kernel_timespec wait = to_timespec(max_wait);
+	r = io_uring_wait_cqe_timeout(ring_.get(), &cqe, &wait);
+	if (r == -ETIME || r == -EINTR) return {};
+	if (r < 0) return system_error(-r);
+
+	while (io_uring_peek_cqe(ring_.get(), &cqe) == 0) {
+		line * l = static_cast<line *>(io_uring_cqe_get_data(cqe));
+		int result = cqe->res;
+		io_uring_cqe_seen(ring_.get(), cqe);
+		if (l) handle(*l, result);
+	}
+
+	r = io_uring_submit(ring_.get());
+	if (r < 0) return system_error(-r);
+	return {};
+}
+
+}
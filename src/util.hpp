@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <system_error>
+
+#include <modbus/error.hpp>
+#include <modbus/modbus.hpp>
+
+// Small helpers shared by the source files. Not installed, and not part of
+// the API.
+
+namespace Modbus {
+namespace detail {
+
+// Whether the slave answered with a valid frame, possibly an exception
+// response.
+inline bool answered(std::error_code e) {
+	return !e || (e.category() == error_category && e.value() < 0x100);
+}
+
+// The error in errno. Always in the generic category, so all errors from
+// the system compare the same way throughout the library.
+inline std::error_code last_error() {
+	return std::error_code(errno, std::generic_category());
+}
+
+struct file_closer {
+	void operator()(std::FILE * f) const { std::fclose(f); }
+};
+
+using file_ptr = std::unique_ptr<std::FILE, file_closer>;
+
+// Little endian encoding, as used by the file formats.
+
+inline void put16(byte_t * p, unsigned int v) {
+	p[0] = v & 0xFF;
+	p[1] = v >> 8 & 0xFF;
+}
+
+inline void put32(byte_t * p, std::uint32_t v) {
+	put16(p, v & 0xFFFF);
+	put16(p + 2, v >> 16);
+}
+
+inline void put64(byte_t * p, std::uint64_t v) {
+	put32(p, v & 0xFFFFFFFF);
+	put32(p + 4, v >> 32);
+}
+
+inline unsigned int get16(byte_t const * p) {
+	return p[0] | p[1] << 8;
+}
+
+inline std::uint32_t get32(byte_t const * p) {
+	return get16(p) | std::uint32_t(get16(p + 2)) << 16;
+}
+
+inline std::uint64_t get64(byte_t const * p) {
+	return get32(p) | std::uint64_t(get32(p + 4)) << 32;
+}
+
+}
+}
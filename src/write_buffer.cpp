@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iterator>
+#include <map>
+
+#include <mstd/error_or.hpp>
+
+#include <modbus/error.hpp>
+#include <modbus/modbus.hpp>
+#include <modbus/write_buffer.hpp>
+
+namespace Modbus {
+
+WriteBuffer::slave_state & WriteBuffer::dirty(byte_t slave_id) {
+	if (slaves_.empty()) oldest_ = clock::now();
+	return slaves_[slave_id];
+}
+
+void WriteBuffer::write_register(byte_t slave_id, uint16_t address, uint16_t value) {
+	auto & s = dirty(slave_id);
+	s.registers[address] = value;
+	// A full write supersedes any pending bit changes.
+	s.bits.erase(address);
+}
+
+void WriteBuffer::write_coil(byte_t slave_id, uint16_t address, bool value) {
+	dirty(slave_id).coils[address] = value;
+}
+
+void WriteBuffer::write_register_bits(byte_t slave_id, uint16_t address, uint16_t mask, uint16_t value) {
+	auto & s = dirty(slave_id);
+	auto r = s.registers.find(address);
+	if (r != s.registers.end()) {
+		r->second = (r->second & ~mask) | (value & mask);
+		return;
+	}
+	auto b = s.bits.find(address);
+	if (b != s.bits.end()) {
+		b->second.value = (b->second.value & ~mask) | (value & mask);
+		b->second.mask |= mask;
+	} else {
+		s.bits[address] = {mask, uint16_t(value & mask)};
+	}
+}
+
+error_or<void> WriteBuffer::commit(Modbus::timeout_t timeout) {
+	for (auto i = slaves_.begin(); i != slaves_.end(); i = slaves_.erase(i)) {
+		if (auto e = commit_registers(i->first, i->second, timeout).error()) return e;
+		if (auto e = commit_coils(i->first, i->second, timeout).error()) return e;
+		if (auto e = commit_bits(i->first, i->second, timeout).error()) return e;
+	}
+	return {};
+}
+
+error_or<void> WriteBuffer::commit_and_read(
+	byte_t slave_id,
+	uint16_t address,
+	range<uint16_t> values,
+	Modbus::timeout_t timeout
+) {
+	auto i = slaves_.find(slave_id);
+	if (no_read_write_[slave_id] || i == slaves_.end() || i->second.registers.empty()) {
+		if (auto e = commit(timeout).error()) return e;
+		return bus_.read_holding_registers(slave_id, address, values, timeout);
+	}
+
+	// Take the last run of dirty registers out of the buffer, and commit
+	// everything else first.
+	auto & registers = i->second.registers;
+	std::array<uint16_t, 121> run;
+	auto end = registers.end();
+	auto begin = std::prev(end);
+	size_t n = 1;
+	while (begin != registers.begin() && n < run.size() && std::prev(begin)->first + 1 == begin->first) {
+		--begin;
+		++n;
+	}
+	uint16_t run_address = begin->first;
+	std::transform(begin, end, run.begin(), [] (auto const & r) { return r.second; });
+	registers.erase(begin, end);
+
+	// On failure, the run is put back, so it is retried on the next commit.
+	// Not through write_register(), as that would restart the age of the
+	// buffer for due() if the rest was committed.
+	auto restore = [&] (std::error_code e) {
+		auto & r = slaves_[slave_id].registers;
+		for (size_t j = 0; j < n; ++j) r[run_address + j] = run[j];
+		return e;
+	};
+
+	if (auto e = commit(timeout).error()) return restore(e);
+
+	range<uint16_t const> write_values{run.data(), n};
+	auto e = bus_.read_write_registers(slave_id, run_address, write_values, address, values, timeout).error();
+	if (e != std::error_code(Error::illegal_function)) {
+		if (e) return restore(e);
+		return {};
+	}
+
+	no_read_write_[slave_id] = true;
+	if (auto e = bus_.write_registers(slave_id, run_address, write_values, timeout).error()) return restore(e);
+	return bus_.read_holding_registers(slave_id, address, values, timeout);
+}
+
+error_or<void> WriteBuffer::commit_registers(byte_t slave_id, slave_state & s, Modbus::timeout_t timeout) {
+	std::array<uint16_t, 123> values;
+	while (!s.registers.empty()) {
+		auto begin = s.registers.begin();
+		auto end = begin;
+		uint16_t address = begin->first;
+		size_t n = 0;
+		while (end != s.registers.end() && end->first == address + n && n < values.size()) {
+			values[n++] = end->second;
+			++end;
+		}
+		if (auto e = bus_.write_registers(slave_id, address, {values.data(), n}, timeout).error()) return e;
+		s.registers.erase(begin, end);
+	}
+	return {};
+}
+
+error_or<void> WriteBuffer::commit_coils(byte_t slave_id, slave_state & s, Modbus::timeout_t timeout) {
+	std::array<unsigned char, 1968> values;
+	while (!s.coils.empty()) {
+		auto begin = s.coils.begin();
+		auto end = begin;
+		uint16_t address = begin->first;
+		size_t n = 0;
+		while (end != s.coils.end() && end->first == address + n && n < values.size()) {
+			values[n++] = end->second;
+			++end;
+		}
+		range<unsigned char const> v{values.data(), n};
+		if (auto e = bus_.write_coils(slave_id, address, v, timeout).error()) return e;
+		s.coils.erase(begin, end);
+	}
+	return {};
+}
+
+error_or<void> WriteBuffer::commit_bits(byte_t slave_id, slave_state & s, Modbus::timeout_t timeout) {
+	while (!s.bits.empty()) {
+		auto i = s.bits.begin();
+		uint16_t address = i->first;
+		uint16_t mask = i->second.mask;
+		uint16_t value = i->second.value;
+		if (!no_mask_write_[slave_id]) {
+			auto e = bus_.mask_write_register(slave_id, address, uint16_t(~mask), value, timeout).error();
+			if (e != std::error_code(Error::illegal_function)) {
+				if (e) return e;
+				s.bits.erase(i);
+				continue;
+			}
+			no_mask_write_[slave_id] = true;
+		}
+		uint16_t current;
+		if (auto e = bus_.read_holding_registers(slave_id, address, current, timeout).error()) return e;
+		current = (current & ~mask) | value;
+		if (auto e = bus_.write_single_register(slave_id, address, current, timeout).error()) return e;
+		s.bits.erase(i);
+	}
+	return {};
+}
+
+}
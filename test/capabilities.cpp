@@ -0,0 +1,167 @@
+// The file format of CapabilityCache: the round trip through save() and
+// load(), the byte layout, and rejection of invalid files.
+
+#include <chrono>
+#include <cstdio>
+#include <system_error>
+#include <vector>
+
+#include <modbus/capabilities.hpp>
+#include <modbus/modbus.hpp>
+#include <modbus/scan.hpp>
+
+#include "check.hpp"
+
+using namespace std::chrono_literals;
+
+using Modbus::byte_t;
+using Modbus::CapabilityCache;
+using Modbus::DeviceProfile;
+
+namespace {
+
+using bytes = std::vector<byte_t>;
+
+char const file_name[] = "test-capabilities.mbc";
+
+bytes read_file() {
+	bytes data;
+	std::FILE * f = std::fopen(file_name, "rb");
+	CHECK(f);
+	for (int c; (c = std::fgetc(f)) != EOF;) data.push_back(c);
+	std::fclose(f);
+	return data;
+}
+
+void write_file(bytes const & data) {
+	std::FILE * f = std::fopen(file_name, "wb");
+	CHECK(f);
+	CHECK(std::fwrite(data.data(), 1, data.size(), f) == data.size());
+	std::fclose(f);
+}
+
+DeviceProfile profile(byte_t slave_id) {
+	DeviceProfile p;
+	p.slave_id = slave_id;
+	p.supported[0x03] = p.supported[0x10] = p.supported[127] = true;
+	p.unsupported[0] = p.unsupported[0x17] = true;
+	p.max_read_registers = 0x7D;
+	p.max_read_coils = 0x7D0;
+	p.typical_latency = 12345us;
+	p.echo = DeviceProfile::Echo::local;
+	return p;
+}
+
+bool same(DeviceProfile const & a, DeviceProfile const & b) {
+	return a.slave_id == b.slave_id
+		&& a.supported == b.supported
+		&& a.unsupported == b.unsupported
+		&& a.max_read_registers == b.max_read_registers
+		&& a.max_read_coils == b.max_read_coils
+		&& a.typical_latency == b.typical_latency
+		&& a.echo == b.echo;
+}
+
+void test_round_trip() {
+	CapabilityCache cache;
+	cache.set(profile(1));
+	auto p = profile(255);
+	p.echo = DeviceProfile::Echo::none;
+	p.supported.reset();
+	p.max_read_coils = 0;
+	cache.set(p);
+	cache.set_echo(17, DeviceProfile::Echo::unknown);
+	CHECK(cache.changed());
+	CHECK(cache.save(file_name));
+	CHECK(!cache.changed());
+
+	CapabilityCache loaded;
+	loaded.set(profile(2));
+	CHECK(loaded.load(file_name));
+	CHECK(!loaded.changed());
+	CHECK(loaded.find(1) && same(*loaded.find(1), profile(1)));
+	CHECK(loaded.find(255) && same(*loaded.find(255), p));
+	CHECK(loaded.find(17) && same(*loaded.find(17), DeviceProfile{17}));
+	// Everything is replaced by what is in the file.
+	CHECK(!loaded.find(2));
+	CHECK(!loaded.find(0));
+}
+
+void test_layout() {
+	CapabilityCache cache;
+	auto p = profile(0x42);
+	// Too long to store: kept as the maximum.
+	p.typical_latency = std::chrono::hours(2);
+	cache.set(p);
+	CHECK(cache.save(file_name));
+
+	bytes expected = {
+		'M', 'B', 'C', 'C', 0x01, 0x00, 0x01, 0x00,
+		0x42, 0x02, 0x7D, 0x00, 0xD0, 0x07, 0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xFF,
+		// Supported: 0x03, 0x10 and 127.
+		0x08, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80,
+		// Unsupported: 0 and 0x17.
+		0x01, 0x00, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	};
+	CHECK(read_file() == expected);
+
+	// An empty cache is just the header.
+	CHECK(CapabilityCache().save(file_name));
+	CHECK(read_file() == bytes({'M', 'B', 'C', 'C', 0x01, 0x00, 0x00, 0x00}));
+}
+
+// Invalid files are rejected, and leave the cache unchanged.
+void test_invalid() {
+	CapabilityCache cache;
+	cache.set(profile(1));
+	CHECK(cache.save(file_name));
+	bytes const valid = read_file();
+
+	auto rejected = [&] (bytes const & data) {
+		write_file(data);
+		CapabilityCache c;
+		c.set(profile(9));
+		auto e = c.load(file_name).error();
+		return e == std::errc::invalid_argument && c.find(9) && !c.find(1);
+	};
+
+	CHECK(!rejected(valid));
+
+	bytes b = valid;
+	b[0] = 'X';
+	CHECK(rejected(b));
+
+	b = valid;
+	b[4] = 2; // Version.
+	CHECK(rejected(b));
+
+	b = valid;
+	b[6] = 2; // Two records, but only one there.
+	CHECK(rejected(b));
+
+	b = valid;
+	b.pop_back();
+	CHECK(rejected(b));
+
+	b = valid;
+	b.push_back(0);
+	CHECK(rejected(b));
+
+	b = valid;
+	b[9] = 3; // Echo.
+	CHECK(rejected(b));
+
+	CHECK(rejected(bytes(valid.begin(), valid.begin() + 7)));
+
+	std::remove(file_name);
+	CHECK(cache.load(file_name).error() == std::errc::no_such_file_or_directory);
+	CHECK(cache.find(1));
+}
+
+}
+
+int main() {
+	test_round_trip();
+	test_layout();
+	test_invalid();
+}
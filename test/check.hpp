@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+// Exits with a message if the condition is false. The tests are plain
+// programs, run by ctest, that fail through their exit code.
+#define CHECK(condition) do { \
+	if (!(condition)) { \
+		std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+		std::exit(1); \
+	} \
+} while (false)
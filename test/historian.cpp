@@ -0,0 +1,177 @@
+// Round trip of samples through the historian file format: the timestamp
+// and value encoding, chunking, appending to a file, and queries.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include <modbus/historian.hpp>
+
+#include "check.hpp"
+
+using namespace std::chrono_literals;
+
+using Modbus::HistorianReader;
+using Modbus::HistorianWriter;
+using Modbus::historian_clock;
+using Modbus::historian_query;
+
+namespace {
+
+char const file_name[] = "test-historian.mbh";
+
+struct sample {
+	historian_clock::time_point time;
+	std::vector<uint16_t> values;
+};
+
+// Samples of three registers: a constant, a slowly rising one, and one that
+// changes in all bits. The time steps are irregular, including a jump of
+// hours and a step back.
+std::vector<sample> make_samples(std::size_t n, historian_clock::time_point start) {
+	std::vector<sample> samples;
+	auto t = start;
+	uint32_t random = 12345;
+	for (std::size_t i = 0; i < n; ++i) {
+		random = random * 1103515245 + 12345;
+		if (i % 7 == 3) t += 5h;
+		else if (i % 11 == 5) t -= 1s;
+		else t += 100ms + std::chrono::microseconds(random % 1000);
+		samples.push_back({t, {0x1234, uint16_t(1000 + i / 3), uint16_t(i % 2 ? random >> 16 : 0xFFFF - i)}});
+	}
+	return samples;
+}
+
+std::vector<sample> read_register(HistorianReader const & reader, historian_query q) {
+	std::vector<sample> r;
+	CHECK(reader.query(q, [&] (historian_clock::time_point t, uint16_t v) { r.push_back({t, {v}}); }));
+	return r;
+}
+
+// Every register of the samples matches what is read back.
+void check_samples(HistorianReader const & reader, std::vector<sample> const & samples) {
+	for (std::size_t i = 0; i < 3; ++i) {
+		historian_query q{7, uint16_t(100 + i)};
+		auto r = read_register(reader, q);
+		CHECK(r.size() == samples.size());
+		for (std::size_t j = 0; j < r.size(); ++j) {
+			CHECK(r[j].time == samples[j].time);
+			CHECK(r[j].values[0] == samples[j].values[i]);
+		}
+	}
+}
+
+void test_round_trip() {
+	std::remove(file_name);
+	auto start = historian_clock::time_point(std::chrono::seconds(1700000000)) + 123456us;
+	auto samples = make_samples(50, start);
+	{
+		HistorianWriter writer(16);
+		CHECK(writer.open(file_name));
+		for (auto const & s : samples) {
+			CHECK(writer.append(7, 100, {s.values.data(), s.values.size()}, s.time));
+			uint16_t other = s.values[1];
+			CHECK(writer.append(8, 0, other, s.time));
+		}
+		CHECK(writer.flush());
+	}
+
+	HistorianReader reader;
+	CHECK(reader.open(file_name));
+	// 50 samples in chunks of 16, for each of the two blocks.
+	CHECK(reader.chunks().size() == 8);
+	std::size_t n = 0;
+	for (auto const & c : reader.chunks()) {
+		if (c.slave_id != 7) continue;
+		CHECK(c.address == 100 && c.count == 3);
+		CHECK(c.samples == (n + 16 <= samples.size() ? 16 : samples.size() - n));
+		CHECK(c.first == samples[n].time);
+		CHECK(c.last == samples[n + c.samples - 1].time);
+		CHECK(c.min(0) == 0x1234 && c.max(0) == 0x1234);
+		CHECK(c.min(1) == samples[n].values[1]);
+		CHECK(c.max(1) == samples[n + c.samples - 1].values[1]);
+		n += c.samples;
+	}
+	CHECK(n == samples.size());
+	check_samples(reader, samples);
+
+	auto other = read_register(reader, {8, 0});
+	CHECK(other.size() == samples.size());
+	for (std::size_t j = 0; j < other.size(); ++j) CHECK(other[j].values[0] == samples[j].values[1]);
+
+	// Nothing for a register outside the blocks.
+	CHECK(read_register(reader, {7, 103}).empty());
+}
+
+void test_query_filters() {
+	HistorianReader reader;
+	CHECK(reader.open(file_name));
+	auto start = historian_clock::time_point(std::chrono::seconds(1700000000)) + 123456us;
+	auto samples = make_samples(50, start);
+
+	historian_query q{7, 101};
+	q.from = samples[10].time;
+	q.to = samples[30].time;
+	q.min_value = 1004;
+	q.max_value = 1007;
+	std::vector<sample> expected;
+	for (auto const & s : samples) {
+		if (s.time >= q.from && s.time < q.to && s.values[1] >= q.min_value && s.values[1] <= q.max_value) {
+			expected.push_back({s.time, {s.values[1]}});
+		}
+	}
+	CHECK(!expected.empty());
+	auto r = read_register(reader, q);
+	CHECK(r.size() == expected.size());
+	for (std::size_t j = 0; j < r.size(); ++j) {
+		CHECK(r[j].time == expected[j].time);
+		CHECK(r[j].values[0] == expected[j].values[0]);
+	}
+}
+
+// An incomplete chunk at the end is ignored by the reader, and cut off by
+// the writer before appending.
+void test_append_after_crash() {
+	auto start = historian_clock::time_point(std::chrono::seconds(1700000000)) + 123456us;
+	auto samples = make_samples(60, start);
+
+	// The start of the first chunk: its complete header, but only part of
+	// its payload.
+	char start_of_chunk[64];
+	std::FILE * f = std::fopen(file_name, "rb");
+	CHECK(f);
+	CHECK(std::fread(start_of_chunk, 1, sizeof(start_of_chunk), f) == sizeof(start_of_chunk));
+	std::fclose(f);
+	f = std::fopen(file_name, "ab");
+	CHECK(f);
+	CHECK(std::fwrite(start_of_chunk, 1, sizeof(start_of_chunk), f) == sizeof(start_of_chunk));
+	std::fclose(f);
+	{
+		HistorianReader reader;
+		CHECK(reader.open(file_name));
+		CHECK(reader.chunks().size() == 8);
+	}
+	{
+		HistorianWriter writer(16);
+		CHECK(writer.open(file_name));
+		for (std::size_t i = 50; i < samples.size(); ++i) {
+			auto const & s = samples[i];
+			CHECK(writer.append(7, 100, {s.values.data(), s.values.size()}, s.time));
+		}
+	}
+
+	HistorianReader reader;
+	CHECK(reader.open(file_name));
+	CHECK(reader.chunks().size() == 9);
+	check_samples(reader, samples);
+	std::remove(file_name);
+}
+
+}
+
+int main() {
+	test_round_trip();
+	test_query_filters();
+	test_append_after_crash();
+}
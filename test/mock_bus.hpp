@@ -0,0 +1,45 @@
+#pragma once
+
+#include <functional>
+#include <system_error>
+#include <vector>
+
+#include <mstd/error_or.hpp>
+#include <mstd/range.hpp>
+
+#include <modbus/error.hpp>
+#include <modbus/modbus.hpp>
+
+// A bus that records every request, and answers with a function of the
+// test. Without one, every request times out.
+class MockBus final : public ::Modbus::Modbus {
+
+public:
+	struct request {
+		::Modbus::byte_t slave_id;
+		::Modbus::byte_t function_code;
+		std::vector<::Modbus::byte_t> parameters;
+	};
+
+	// Fills the response buffer, and returns the size of the response, or
+	// an error.
+	using responder = std::function<mstd::error_or<std::size_t> (request const &, mstd::range<::Modbus::byte_t>)>;
+
+	std::vector<request> requests;
+	responder respond;
+
+	mstd::error_or<mstd::range<::Modbus::byte_t>> raw_command(
+		::Modbus::byte_t slave_id,
+		::Modbus::byte_t function_code,
+		mstd::range<::Modbus::byte_t const> parameters,
+		mstd::range<::Modbus::byte_t> response_buffer,
+		timeout_t
+	) override {
+		requests.push_back({slave_id, function_code, {parameters.begin(), parameters.end()}});
+		if (!respond) return std::error_code(::Modbus::Error::timeout);
+		auto n = respond(requests.back(), response_buffer);
+		if (!n) return n.error();
+		return response_buffer.subrange(0, *n);
+	}
+
+};
@@ -0,0 +1,95 @@
+// The buckets, percentiles and decay of ResponseTimeHistogram, as used for
+// the adaptive timeouts of ModbusSerial.
+
+#include <chrono>
+#include <cstdint>
+
+#include <modbus/response_time.hpp>
+
+#include "check.hpp"
+
+using namespace std::chrono_literals;
+
+using Modbus::ResponseTimeHistogram;
+
+namespace {
+
+// The upper bound of the bucket of t.
+std::chrono::microseconds bound(std::chrono::microseconds t) {
+	ResponseTimeHistogram h;
+	h.add(t);
+	return h.percentile(1.0);
+}
+
+void test_buckets() {
+	CHECK(bound(0us) == 64us);
+	CHECK(bound(-5us) == 64us);
+	CHECK(bound(63us) == 64us);
+	CHECK(bound(64us) == 80us);
+	CHECK(bound(79us) == 80us);
+	CHECK(bound(80us) == 96us);
+	CHECK(bound(127us) == 128us);
+	CHECK(bound(128us) == 160us);
+
+	// Above 64µs, every bound is above the sample, by at most a quarter.
+	auto previous = 64us;
+	for (std::int64_t us = 64; us < 16000000; us += us / 37 + 1) {
+		auto b = bound(std::chrono::microseconds(us));
+		CHECK(b.count() > us);
+		CHECK(4 * b.count() <= 5 * us);
+		CHECK(b >= previous);
+		previous = b;
+	}
+
+	// The last bucket takes everything above about 16s.
+	CHECK(bound(16777215us) == 16777216us);
+	CHECK(bound(100s) == 16777216us);
+}
+
+void test_percentile() {
+	ResponseTimeHistogram h;
+	CHECK(h.size() == 0);
+	CHECK(h.percentile(0.99) == 0us);
+
+	for (int i = 0; i < 90; ++i) h.add(1ms);
+	for (int i = 0; i < 10; ++i) h.add(50ms);
+	CHECK(h.size() == 100);
+	CHECK(h.percentile(0) == bound(1ms));
+	CHECK(h.percentile(0.5) == bound(1ms));
+	CHECK(h.percentile(0.89) == bound(1ms));
+	CHECK(h.percentile(0.9) == bound(50ms));
+	CHECK(h.percentile(0.99) == bound(50ms));
+	CHECK(h.percentile(1.0) == bound(50ms));
+
+	h.clear();
+	CHECK(h.size() == 0);
+	CHECK(h.percentile(0.5) == 0us);
+}
+
+// Once full, the counts are halved, so recent samples take over.
+void test_decay() {
+	ResponseTimeHistogram h;
+	for (std::uint32_t i = 0; i < ResponseTimeHistogram::max_samples; ++i) h.add(1ms);
+	CHECK(h.size() == ResponseTimeHistogram::max_samples);
+
+	h.add(50ms);
+	CHECK(h.size() == ResponseTimeHistogram::max_samples / 2 + 1);
+	for (std::uint32_t i = 1; i < ResponseTimeHistogram::max_samples / 2; ++i) h.add(50ms);
+	CHECK(h.size() == ResponseTimeHistogram::max_samples);
+	CHECK(h.percentile(0.4) == bound(1ms));
+	CHECK(h.percentile(0.6) == bound(50ms));
+
+	for (std::uint32_t i = 0; i < 4 * ResponseTimeHistogram::max_samples; ++i) {
+		h.add(50ms);
+		CHECK(h.size() <= ResponseTimeHistogram::max_samples);
+	}
+	CHECK(h.percentile(0.1) == bound(50ms));
+}
+
+}
+
+int main() {
+	test_buckets();
+	test_percentile();
+	test_decay();
+}
@@ -0,0 +1,146 @@
+// Validation of RTU responses by RtuResponseParser, as used by the serial,
+// socket and io_uring transports.
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+#include <modbus/error.hpp>
+#include <modbus/modbus.hpp>
+#include <modbus/rtu.hpp>
+
+#include "check.hpp"
+
+using Modbus::byte_t;
+using Modbus::Error;
+using Modbus::RtuResponseParser;
+
+namespace {
+
+using bytes = std::vector<byte_t>;
+
+// An ADU with a valid crc.
+bytes frame(byte_t slave_id, byte_t function_code, bytes data) {
+	bytes adu(data.size() + 4);
+	adu.resize(Modbus::rtu_encode(slave_id, function_code, {data.data(), data.size()}, adu.data()));
+	return adu;
+}
+
+// A read_holding_registers response with two registers.
+bytes const registers = {0x04, 0x12, 0x34, 0x56, 0x78};
+
+void test_complete_frame() {
+	std::array<byte_t, 5> buffer;
+	RtuResponseParser p(1, 0x03, buffer);
+	auto f = frame(1, 0x03, registers);
+	p.add({f.data(), f.size()});
+	CHECK(p.expected_size() == 9);
+	CHECK(p.complete());
+	auto r = p.result();
+	CHECK(r);
+	CHECK(r->size() == 5);
+	CHECK(bytes(r->begin(), r->end()) == registers);
+}
+
+void test_split_frame() {
+	std::array<byte_t, 5> buffer;
+	RtuResponseParser p(1, 0x03, buffer);
+	auto f = frame(1, 0x03, registers);
+	// The parts of a frame arrive in separate reads.
+	p.add({f.data(), 3});
+	CHECK(!p.complete());
+	p.add({f.data() + 3, 4});
+	CHECK(!p.complete());
+	p.add({f.data() + 7, f.size() - 7});
+	CHECK(p.complete());
+	CHECK(p.result());
+}
+
+void test_trailing_garbage() {
+	std::array<byte_t, 5> buffer;
+	RtuResponseParser p(1, 0x03, buffer);
+	auto f = frame(1, 0x03, registers);
+	f.push_back(0x00);
+	f.push_back(0xFF);
+	p.add({f.data(), f.size()});
+	CHECK(!p.complete());
+	CHECK(!p.result());
+}
+
+void test_short_response() {
+	// A response that doesn't fill the buffer (e.g. read_fifo_queue) only
+	// ends by a valid crc, and the transport deciding nothing more follows.
+	std::array<byte_t, 10> buffer;
+	RtuResponseParser p(1, 0x18, buffer);
+	bytes data = {0x00, 0x04, 0x00, 0x01, 0xAB, 0xCD};
+	auto f = frame(1, 0x18, data);
+	p.add({f.data(), f.size()});
+	CHECK(p.crc_ok());
+	CHECK(!p.complete());
+	auto r = p.result();
+	CHECK(r);
+	CHECK(bytes(r->begin(), r->end()) == data);
+}
+
+void test_exception_response() {
+	std::array<byte_t, 5> buffer;
+	RtuResponseParser p(1, 0x03, buffer);
+	auto f = frame(1, 0x83, {0x02});
+	p.add({f.data(), f.size()});
+	CHECK(p.expected_size() == 5);
+	CHECK(p.complete());
+	CHECK(p.result().error() == std::error_code(Error::illegal_data_address));
+}
+
+void test_invalid_frames() {
+	std::array<byte_t, 5> buffer;
+	{
+		RtuResponseParser p(1, 0x03, buffer);
+		CHECK(p.result().error() == std::error_code(Error::timeout));
+	}
+	{
+		RtuResponseParser p(1, 0x03, buffer);
+		p.add({registers.data(), 3});
+		CHECK(p.result().error() == std::error_code(Error::bad_frame));
+	}
+	{
+		RtuResponseParser p(1, 0x03, buffer);
+		auto f = frame(1, 0x03, registers);
+		f[3] ^= 1;
+		p.add({f.data(), f.size()});
+		CHECK(!p.complete());
+		CHECK(p.result().error() == std::error_code(Error::bad_crc));
+	}
+	{
+		// Another slave.
+		RtuResponseParser p(1, 0x03, buffer);
+		auto f = frame(2, 0x03, registers);
+		p.add({f.data(), f.size()});
+		CHECK(p.result().error() == std::error_code(Error::invalid_response));
+	}
+	{
+		// Another function.
+		RtuResponseParser p(1, 0x03, buffer);
+		auto f = frame(1, 0x04, registers);
+		p.add({f.data(), f.size()});
+		CHECK(p.result().error() == std::error_code(Error::invalid_response));
+	}
+	{
+		// More data than fits in the buffer, with a valid crc.
+		RtuResponseParser p(1, 0x03, buffer);
+		auto f = frame(1, 0x03, {0x06, 1, 2, 3, 4, 5, 6});
+		p.add({f.data(), f.size()});
+		CHECK(p.result().error() == std::error_code(Error::invalid_response));
+	}
+}
+
+}
+
+int main() {
+	test_complete_frame();
+	test_split_frame();
+	test_trailing_garbage();
+	test_short_response();
+	test_exception_response();
+	test_invalid_frames();
+}
@@ -0,0 +1,174 @@
+// ModbusRtuSocket against a simulated serial device server on localhost,
+// for the framing rules of TCP and UDP.
+
+#include <array>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <modbus/error.hpp>
+#include <modbus/modbus.hpp>
+#include <modbus/rtu.hpp>
+#include <modbus/rtu_socket.hpp>
+
+#include "check.hpp"
+
+using namespace std::chrono_literals;
+
+using Modbus::byte_t;
+using Modbus::Error;
+using Modbus::ModbusRtuSocket;
+
+namespace {
+
+using bytes = std::vector<byte_t>;
+
+bytes frame(byte_t slave_id, byte_t function_code, bytes data) {
+	bytes adu(data.size() + 4);
+	adu.resize(Modbus::rtu_encode(slave_id, function_code, {data.data(), data.size()}, adu.data()));
+	return adu;
+}
+
+// What the server sends in reply to a request: parts, with a pause before
+// each of them.
+struct part {
+	std::chrono::milliseconds pause;
+	bytes data;
+};
+
+using reply = std::vector<part>;
+
+// A server on a free port of localhost, answering every request with the
+// next reply. For TCP, every part is written separately; for UDP, every
+// part is a datagram.
+class Server {
+
+	int fd_;
+	bool tcp_;
+	std::thread thread_;
+
+public:
+	Server(bool tcp, std::vector<reply> replies) : tcp_(tcp) {
+		fd_ = ::socket(AF_INET, tcp ? SOCK_STREAM : SOCK_DGRAM, 0);
+		CHECK(fd_ >= 0);
+		sockaddr_in a = {};
+		a.sin_family = AF_INET;
+		a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		CHECK(::bind(fd_, reinterpret_cast<sockaddr *>(&a), sizeof(a)) == 0);
+		if (tcp) CHECK(::listen(fd_, 1) == 0);
+		thread_ = std::thread([this, replies] { run(replies); });
+	}
+
+	~Server() {
+		thread_.join();
+		::close(fd_);
+	}
+
+	std::string port() const {
+		sockaddr_in a = {};
+		socklen_t size = sizeof(a);
+		CHECK(::getsockname(fd_, reinterpret_cast<sockaddr *>(&a), &size) == 0);
+		return std::to_string(ntohs(a.sin_port));
+	}
+
+private:
+	void run(std::vector<reply> const & replies) {
+		int fd = tcp_ ? ::accept(fd_, nullptr, nullptr) : fd_;
+		CHECK(fd >= 0);
+		for (auto const & r : replies) {
+			std::array<byte_t, 256> request;
+			sockaddr_in from = {};
+			socklen_t from_size = sizeof(from);
+			CHECK(::recvfrom(fd, request.data(), request.size(), 0, reinterpret_cast<sockaddr *>(&from), &from_size) > 0);
+			for (auto const & p : r) {
+				std::this_thread::sleep_for(p.pause);
+				if (tcp_) CHECK(::send(fd, p.data.data(), p.data.size(), 0) == ssize_t(p.data.size()));
+				else CHECK(::sendto(fd, p.data.data(), p.data.size(), 0, reinterpret_cast<sockaddr *>(&from), from_size) == ssize_t(p.data.size()));
+			}
+		}
+		if (tcp_) ::close(fd);
+	}
+
+};
+
+bytes const registers = {0x04, 0x12, 0x34, 0x56, 0x78};
+
+void test_tcp() {
+	auto f = frame(1, 0x03, registers);
+	bytes head(f.begin(), f.begin() + 4);
+	bytes tail(f.begin() + 4, f.end());
+	auto fifo = frame(1, 0x18, {0x00, 0x04, 0x00, 0x01, 0xAB, 0xCD});
+	auto garbage = f;
+	garbage.push_back(0x55);
+
+	Server server(true, {
+		{{0ms, f}},
+		// Split into two writes, within the gap timeout.
+		{{0ms, head}, {20ms, tail}},
+		// Ends by its crc and a pause, as it doesn't fill the buffer.
+		{{0ms, fifo}},
+		// Trailing garbage after the frame.
+		{{0ms, garbage}},
+	});
+
+	ModbusRtuSocket bus;
+	CHECK(!bus.connect(ModbusRtuSocket::Protocol::tcp, "127.0.0.1", server.port().c_str()).error());
+
+	std::array<uint16_t, 2> values;
+	CHECK(!bus.read_holding_registers(1, 0, values, 500ms).error());
+	CHECK(values[0] == 0x1234 && values[1] == 0x5678);
+
+	values = {};
+	CHECK(!bus.read_holding_registers(1, 0, values, 500ms).error());
+	CHECK(values[0] == 0x1234 && values[1] == 0x5678);
+
+	std::array<uint16_t, 31> queue;
+	auto start = std::chrono::steady_clock::now();
+	auto n = bus.read_fifo_queue(1, 0, queue, 500ms);
+	CHECK(n && *n == 1 && queue[0] == 0xABCD);
+	// Well before the timeout or the gap timeout.
+	CHECK(std::chrono::steady_clock::now() - start < 90ms);
+
+	bus.set_gap_timeout(20ms);
+	CHECK(bus.read_holding_registers(1, 0, values, 500ms).error());
+}
+
+void test_udp() {
+	auto f = frame(1, 0x03, registers);
+	auto fifo = frame(1, 0x18, {0x00, 0x04, 0x00, 0x01, 0xAB, 0xCD});
+	auto oversized = f;
+	oversized.resize(257, 0);
+
+	Server server(false, {
+		{{0ms, f}},
+		// Ends with the datagram.
+		{{0ms, fifo}},
+		{{0ms, oversized}},
+	});
+
+	ModbusRtuSocket bus;
+	CHECK(!bus.connect(ModbusRtuSocket::Protocol::udp, "127.0.0.1", server.port().c_str()).error());
+
+	std::array<uint16_t, 2> values;
+	CHECK(!bus.read_holding_registers(1, 0, values, 500ms).error());
+	CHECK(values[0] == 0x1234 && values[1] == 0x5678);
+
+	std::array<uint16_t, 31> queue;
+	auto n = bus.read_fifo_queue(1, 0, queue, 500ms);
+	CHECK(n && *n == 1 && queue[0] == 0xABCD);
+
+	CHECK(bus.read_holding_registers(1, 0, values, 500ms).error() == std::error_code(Error::bad_frame));
+}
+
+}
+
+int main() {
+	test_tcp();
+	test_udp();
+}
@@ -0,0 +1,104 @@
+// The read_write_registers (0x17) encoding, and its use by
+// WriteBuffer::commit_and_read().
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <modbus/error.hpp>
+#include <modbus/modbus.hpp>
+#include <modbus/write_buffer.hpp>
+
+#include "check.hpp"
+#include "mock_bus.hpp"
+
+using namespace std::chrono_literals;
+
+using Modbus::byte_t;
+using Modbus::Error;
+
+namespace {
+
+using bytes = std::vector<byte_t>;
+
+// Answers a read_write_registers request with the given registers.
+MockBus::responder read_write_response(std::vector<uint16_t> registers) {
+	return [registers] (MockBus::request const & r, mstd::range<byte_t> response) -> mstd::error_or<std::size_t> {
+		if (r.function_code != 0x17) return std::error_code(Error::illegal_function);
+		response[0] = registers.size() * 2;
+		for (std::size_t i = 0; i < registers.size(); ++i) {
+			response[1 + i * 2] = registers[i] >> 8;
+			response[2 + i * 2] = registers[i] & 0xFF;
+		}
+		return 1 + registers.size() * 2;
+	};
+}
+
+void test_encoding() {
+	MockBus bus;
+	bus.respond = read_write_response({0xAAAA, 0xBBBB, 0xCCCC});
+	std::array<uint16_t, 2> write_values = {{0x1234, 0x5678}};
+	std::array<uint16_t, 3> read_values;
+	CHECK(!bus.read_write_registers(7, 0x0010, write_values, 0x0020, read_values, 10ms).error());
+	CHECK(bus.requests.size() == 1);
+	CHECK(bus.requests[0].slave_id == 7);
+	CHECK(bus.requests[0].function_code == 0x17);
+	// Read address and quantity, write address, quantity, byte count, and
+	// the values to write.
+	CHECK(bus.requests[0].parameters == (bytes{0x00, 0x20, 0x00, 0x03, 0x00, 0x10, 0x00, 0x02, 0x04, 0x12, 0x34, 0x56, 0x78}));
+	CHECK(read_values[0] == 0xAAAA && read_values[1] == 0xBBBB && read_values[2] == 0xCCCC);
+}
+
+void test_commit_and_read() {
+	MockBus bus;
+	bus.respond = read_write_response({0x0001, 0x0002});
+	Modbus::WriteBuffer buffer(bus);
+	buffer.write_register(1, 0x0101, 0x2222);
+	buffer.write_register(1, 0x0100, 0x1111);
+	std::array<uint16_t, 2> values;
+	CHECK(!buffer.commit_and_read(1, 0x0200, values, 10ms).error());
+	CHECK(buffer.empty());
+	CHECK(bus.requests.size() == 1);
+	CHECK(bus.requests[0].function_code == 0x17);
+	CHECK(bus.requests[0].parameters == (bytes{0x02, 0x00, 0x00, 0x02, 0x01, 0x00, 0x00, 0x02, 0x04, 0x11, 0x11, 0x22, 0x22}));
+	CHECK(values[0] == 0x0001 && values[1] == 0x0002);
+}
+
+void test_restore_on_error() {
+	MockBus bus;
+	auto max_delay = 50ms;
+	Modbus::WriteBuffer buffer(bus, max_delay);
+	buffer.write_register(1, 0x0100, 0x1111);
+	auto written = Modbus::WriteBuffer::clock::now();
+	std::this_thread::sleep_for(2ms);
+
+	// Without a responder, the 0x17 request times out.
+	std::array<uint16_t, 1> values;
+	CHECK(buffer.commit_and_read(1, 0x0200, values, 10ms).error() == std::error_code(Error::timeout));
+	CHECK(bus.requests.size() == 1);
+	CHECK(!buffer.empty());
+	// The write kept its age.
+	CHECK(buffer.due(written + max_delay));
+
+	// The retry sends the same value, now as a write_single_register (0x06),
+	// which the slave answers with an echo of the request.
+	bus.respond = [] (MockBus::request const & r, mstd::range<byte_t> response) -> mstd::error_or<std::size_t> {
+		std::copy(r.parameters.begin(), r.parameters.end(), response.begin());
+		return r.parameters.size();
+	};
+	CHECK(!buffer.commit(10ms).error());
+	CHECK(buffer.empty());
+	CHECK(bus.requests.size() == 2);
+	CHECK(bus.requests[1].function_code == 0x06);
+	CHECK(bus.requests[1].parameters == (bytes{0x01, 0x00, 0x11, 0x11}));
+}
+
+}
+
+int main() {
+	test_encoding();
+	test_commit_and_read();
+	test_restore_on_error();
+}
@@ -1,18 +1,66 @@
+#include <algorithm>
+#include <cerrno>
 #include <chrono>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <system_error>
 #include <vector>
 
+#include <modbus/autodetect.hpp>
+#include <modbus/capabilities.hpp>
 #include <modbus/modbus.hpp>
+#include <modbus/scan.hpp>
+#include <modbus/serial.hpp>
+#include <modbus/serial_ascii.hpp>
 #include <modbus/serial_rtu.hpp>
 
+#ifdef MODBUS_TOOL_RS485
+#include <modbus/rs485.hpp>
+#endif
+#ifdef MODBUS_TOOL_SOCKET
+#include <modbus/rtu_socket.hpp>
+#endif
+
 using namespace std::chrono_literals;
 using namespace Modbus;
 using namespace Serial;
 
 void usage(char const * argv0) {
 	std::puts("\nUsage:");
-	std::printf("\t%s <port> [-s <baud-rate>[(N|E|O)[<stop-bits>]]] <slave-id> <command>\n", argv0);
+	std::printf("\t%s <port> [-s <baud-rate>[(N|E|O)[<stop-bits>]]|auto] [-d] [-a|-e] [-c <capability-cache>] <slave-id> <command>\n", argv0);
+	std::printf("\t%s <port> [-s ...] [-d] [-a|-e] scan [<first-slave-id> <last-slave-id>] [-o <capability-cache>]\n", argv0);
+	std::printf("\t%s <port> [-s ...] [-d] [-a|-e] [-c ...] batch [-k] [<file>]\n", argv0);
+	std::printf("\t%s <port> [-s ...] [-d] [-a|-e] [-c ...] bench [-t <seconds>] [-r <rate>[,<rate>...]] <slave-id> <command> [\\; <command>]...\n", argv0);
+	std::printf("\t%s detect [-i <slave-id>] <port>...\n", argv0);
+	std::puts("\nOptions:");
+	std::puts("\t-s\tConfigure the serial port. The parity defaults to E, and the stop bits");
+	std::puts("\t\tto 1. With auto, use the settings remembered for the port, or detect");
+	std::puts("\t\tthem (RTU only). Without -s, the port is left as it is, and assumed to");
+	std::puts("\t\tbe 19200E1.");
+	std::puts("\t-i\tThe slave to probe when detecting serial settings (default 1).");
+	std::puts("\t-a\tUse Modbus ASCII (with seven data bits) instead of RTU.");
+	std::puts("\t-e\tSkip the local echo of half-duplex RS-485 adapters.");
+#ifdef MODBUS_TOOL_RS485
+	std::puts("\t-d\tLet the serial driver switch the RS-485 direction, and suppress the");
+	std::puts("\t\tlocal echo. Not all drivers support this.");
+#endif
+	std::puts("\t-c\tCheck requests against a capability cache, and update it with what is");
+	std::puts("\t\tlearned from the responses. A missing file is created.");
+	std::puts("\t-k\tIn batch mode, continue after a failing command.");
+	std::puts("\t-t\tIn bench mode, the duration of every step (default 5 seconds).");
+	std::puts("\t-r\tIn bench mode, the request rates (per second) to try. By default, the");
+	std::puts("\t\trate starts at 10 and doubles until the target saturates. A rate of 0");
+	std::puts("\t\tmeans as fast as possible, which is always tried last.");
+#ifdef MODBUS_TOOL_SOCKET
+	std::puts("\nInstead of a serial port, <port> can be tcp:<host>:<port> or udp:<host>:<port>,");
+	std::puts("to send RTU frames to a serial device server.");
+#endif
 	std::puts("\nCommands:");
 	std::puts("\tread-coils <address> <length>");
 	std::puts("\tread-inputs <address> <length>");
@@ -28,6 +76,15 @@ void usage(char const * argv0) {
 	std::puts("\twrite-file-record (<file <address> <value>... \\;)...");
 	std::puts("\tmask-write-register <address> <and-mask> <or-mask>");
 	std::puts("\tread-write-registers <read-address> <read-length> <write-address> <write-value>...");
+	std::puts("\tread-fifo-queue <address>");
+	std::puts("\nThe scan command can save the found slaves as a capability cache (see");
+	std::puts("modbus/capabilities.hpp), to check requests before sending them with -c.");
+	std::puts("\nIn batch mode, every line of the file (or stdin) is <slave-id> <command>.");
+	std::puts("\nThe detect command detects the serial settings of all ports in parallel.");
+	std::puts("Detected settings are remembered in $MODBUS_LINES (default ~/.modbus-lines).");
+	std::puts("\nIn bench mode, the commands are sent in turn, and the results are written to");
+	std::puts("stdout as JSON. Only read commands, write-single-coil, write-single-register,");
+	std::puts("write-multiple-registers, mask-write-register and read-fifo-queue can be used.");
 }
 
 void show_bits(uint16_t address, std::vector<unsigned char> const & v) {
@@ -38,14 +95,13 @@ void show_regs(uint16_t address, std::vector<uint16_t> const & v) {
 	for (auto r : v) std::printf("0x%04X: 0x%04X (%d)\n", address++, r, r);
 }
 
+std::string error_message(std::error_code e) {
+	return std::string(e.category().name()) + " error " + std::to_string(e.value()) + ": " + e.message();
+}
+
 void check(mstd::error_or<void> const & e) {
 	if (e.error()) {
-		std::fprintf(
-			stderr, "%s error %d: %s\n",
-			e.error().category().name(),
-			e.error().value(),
-			e.error().message().c_str()
-		);
+		std::fprintf(stderr, "%s\n", error_message(e.error()).c_str());
 		std::exit(1);
 	}
 }
@@ -60,126 +116,136 @@ unsigned int parse_uint(char const * src) {
 	return v;
 }
 
-int main(int argc, char * * argv) {
-	char const * argv0 = argv[0];
-	++argv;
+// The arguments of a command, from the command line or from a line of a
+// batch file. Instead of exiting, the first invalid or missing argument is
+// kept in error(), and any further arguments read as empty (or zero).
+class Arguments {
 
-	if (argc <= 1) {
-		puts("Modbus tool.");
-		usage(argv0);
-		return 0;
+	char * * argv_;
+	std::string error_;
+
+public:
+	explicit Arguments(char * * argv) : argv_(argv) {}
+
+	bool empty() const { return !*argv_; }
+
+	bool ok() const { return error_.empty(); }
+
+	std::string const & error() const { return error_; }
+
+	void fail(std::string e) {
+		if (ok()) error_ = std::move(e);
 	}
 
-	auto next_arg = [&] {
-		char * arg = *argv++;
-		if (!arg) {
-			fputs("Missing argument.\n", stderr);
-			std::exit(1);
+	char const * next() {
+		if (!*argv_) {
+			fail("Missing argument.");
+			return "";
 		}
-		return arg;
-	};
+		return *argv_++;
+	}
 
-	Port port;
-	check(port.open(next_arg()));
-
-	if (*argv && (*argv)[0] == '-' && (*argv)[1] == 's') {
-		char * a = next_arg() + 2;
-		if (*a == '\0') a = next_arg();
-		int baud = std::strtol(a, &a, 10);
-		Parity parity;
-		if (*a == '\0' || *a == 'N') parity = Parity::none;
-		else if (*a == 'E') parity = Parity::even;
-		else if (*a == 'O') parity = Parity::odd;
-		else {
-			fprintf(stderr, "Expected serial port pairty (N, E or O), but got \"%c\".\n", *a);
-			std::exit(1);
-		}
-		if (*a) ++a;
-		StopBits stop_bits;
-		if (a[0] == '\0' || (a[0] == '1' && a[1] == '\0')) stop_bits = StopBits::one;
-		else if (a[0] == '2' && a[1] == '\0') stop_bits = StopBits::two;
-		else {
-			fprintf(stderr, "Expected serial port stop bits (1 or 2), but got \"%s\".\n", a);
-			std::exit(1);
+	unsigned int to_uint(char const * src) {
+		if (!ok()) return 0;
+		char * s;
+		unsigned int v = std::strtol(src, &s, 0);
+		if (s == src || *s != '\0') {
+			fail("Expected integer, but got \"" + std::string(src) + "\".");
+			return 0;
 		}
-		port.set(baud, parity, stop_bits);
+		return v;
 	}
 
-	ModbusSerialRtu bus(std::move(port));
+	unsigned int next_uint() { return to_uint(next()); }
 
-	uint8_t slave_id = parse_uint(next_arg());
+};
 
-	char const * cmd = next_arg();
+// Run one command, and show its result on stdout.
+// Invalid arguments are reported as std::errc::invalid_argument, with the
+// details in args.error().
+error_or<void> run_command(::Modbus::Modbus & bus, byte_t slave_id, char const * cmd, Arguments & args) {
+	auto invalid = std::make_error_code(std::errc::invalid_argument);
 
 	if (std::strcmp(cmd, "read-coils") == 0) {
-		uint16_t address = parse_uint(next_arg());
-		std::vector<unsigned char> values(parse_uint(next_arg()));
-		check(bus.read_coils(slave_id, address, values, 1s));
+		uint16_t address = args.next_uint();
+		std::vector<unsigned char> values(args.next_uint());
+		if (!args.ok()) return invalid;
+		if (auto e = bus.read_coils(slave_id, address, values, 1s).error()) return e;
 		show_bits(address, values);
 
 	} else if (std::strcmp(cmd, "read-inputs") == 0) {
-		uint16_t address = parse_uint(next_arg());
-		std::vector<unsigned char> values(parse_uint(next_arg()));
-		check(bus.read_inputs(slave_id, address, values, 1s));
+		uint16_t address = args.next_uint();
+		std::vector<unsigned char> values(args.next_uint());
+		if (!args.ok()) return invalid;
+		if (auto e = bus.read_inputs(slave_id, address, values, 1s).error()) return e;
 		show_bits(address, values);
 
 	} else if (std::strcmp(cmd, "read-holding-registers") == 0) {
-		uint16_t address = parse_uint(next_arg());
-		std::vector<uint16_t> values(parse_uint(next_arg()));
-		check(bus.read_holding_registers(slave_id, address, values, 1s));
+		uint16_t address = args.next_uint();
+		std::vector<uint16_t> values(args.next_uint());
+		if (!args.ok()) return invalid;
+		if (auto e = bus.read_holding_registers(slave_id, address, values, 1s).error()) return e;
 		show_regs(address, values);
 
 	} else if (std::strcmp(cmd, "read-input-registers") == 0) {
-		uint16_t address = parse_uint(next_arg());
-		std::vector<uint16_t> values(parse_uint(next_arg()));
-		check(bus.read_input_registers(slave_id, address, values, 1s));
+		uint16_t address = args.next_uint();
+		std::vector<uint16_t> values(args.next_uint());
+		if (!args.ok()) return invalid;
+		if (auto e = bus.read_input_registers(slave_id, address, values, 1s).error()) return e;
 		show_regs(address, values);
 
 	} else if (std::strcmp(cmd, "write-single-coil") == 0) {
-		uint16_t address = parse_uint(next_arg());
-		uint16_t value = parse_uint(next_arg());
-		check(bus.write_single_coil(slave_id, address, value, 1s));
+		uint16_t address = args.next_uint();
+		uint16_t value = args.next_uint();
+		if (!args.ok()) return invalid;
+		if (auto e = bus.write_single_coil(slave_id, address, value, 1s).error()) return e;
 
 	} else if (std::strcmp(cmd, "write-single-register") == 0) {
-		uint16_t address = parse_uint(next_arg());
-		uint16_t value = parse_uint(next_arg());
-		check(bus.write_single_register(slave_id, address, value, 1s));
+		uint16_t address = args.next_uint();
+		uint16_t value = args.next_uint();
+		if (!args.ok()) return invalid;
+		if (auto e = bus.write_single_register(slave_id, address, value, 1s).error()) return e;
 
 	} else if (std::strcmp(cmd, "write-multiple-coils") == 0) {
-		uint16_t address = parse_uint(next_arg());
+		uint16_t address = args.next_uint();
 		std::vector<unsigned char> values;
-		while (char * a = *argv++) values.push_back(bool(parse_uint(a)));
-		check(bus.write_multiple_coils(slave_id, address, values, 1s));
+		while (!args.empty()) values.push_back(bool(args.next_uint()));
+		if (!args.ok()) return invalid;
+		if (auto e = bus.write_multiple_coils(slave_id, address, values, 1s).error()) return e;
 
 	} else if (std::strcmp(cmd, "write-multiple-registers") == 0) {
-		uint16_t address = parse_uint(next_arg());
+		uint16_t address = args.next_uint();
 		std::vector<uint16_t> values;
-		while (char * a = *argv++) values.push_back(parse_uint(a));
-		check(bus.write_multiple_registers(slave_id, address, values, 1s));
+		while (!args.empty()) values.push_back(args.next_uint());
+		if (!args.ok()) return invalid;
+		if (auto e = bus.write_multiple_registers(slave_id, address, values, 1s).error()) return e;
 
 	} else if (std::strcmp(cmd, "write-coils") == 0) {
-		uint16_t address = parse_uint(next_arg());
+		uint16_t address = args.next_uint();
 		std::vector<unsigned char> values;
-		while (char * a = *argv++) values.push_back(bool(parse_uint(a)));
-		check(bus.write_coils(slave_id, address, values, 1s));
+		while (!args.empty()) values.push_back(bool(args.next_uint()));
+		if (!args.ok()) return invalid;
+		if (auto e = bus.write_coils(slave_id, address, values, 1s).error()) return e;
 
 	} else if (std::strcmp(cmd, "write-registers") == 0) {
-		uint16_t address = parse_uint(next_arg());
+		uint16_t address = args.next_uint();
 		std::vector<uint16_t> values;
-		while (char * a = *argv++) values.push_back(parse_uint(a));
-		check(bus.write_registers(slave_id, address, values, 1s));
+		while (!args.empty()) values.push_back(args.next_uint());
+		if (!args.ok()) return invalid;
+		if (auto e = bus.write_registers(slave_id, address, values, 1s).error()) return e;
 
 	} else if (std::strcmp(cmd, "read-file-record") == 0) {
 		std::vector<::Modbus::Modbus::read_file_group> groups;
 		std::vector<std::vector<uint16_t>> data;
-		while (*argv) {
+		while (!args.empty()) {
 			groups.emplace_back();
-			groups.back().file_number = parse_uint(next_arg());
-			groups.back().address = parse_uint(next_arg());
-			data.emplace_back(parse_uint(next_arg()));
+			groups.back().file_number = args.next_uint();
+			groups.back().address = args.next_uint();
+			data.emplace_back(args.next_uint());
 			groups.back().data = data.back();
 		}
-		check(bus.read_file_record(slave_id, groups, 1s));
+		if (!args.ok()) return invalid;
+		if (auto e = bus.read_file_record(slave_id, groups, 1s).error()) return e;
 		for (size_t i = 0; i < groups.size(); ++i) {
 			printf("FILE 0x%04X:\n", groups[i].file_number);
 			show_regs(groups[i].address, data[i]);
@@ -188,38 +254,655 @@ int main(int argc, char * * argv) {
 	} else if (std::strcmp(cmd, "write-file-record") == 0) {
 		std::vector<::Modbus::Modbus::write_file_group> groups;
 		std::vector<std::vector<uint16_t>> data;
-		while (*argv) {
+		while (!args.empty()) {
 			groups.emplace_back();
-			groups.back().file_number = parse_uint(next_arg());
-			groups.back().address = parse_uint(next_arg());
+			groups.back().file_number = args.next_uint();
+			groups.back().address = args.next_uint();
 			data.emplace_back();
-			while (*argv) {
-				char const * a = next_arg();
+			while (!args.empty()) {
+				char const * a = args.next();
 				if (std::strcmp(a, ";") == 0) break;
-				data.back().push_back(parse_uint(a));
+				data.back().push_back(args.to_uint(a));
 			}
 			groups.back().data = data.back();
 		}
-		check(bus.write_file_record(slave_id, groups, 1s));
+		if (!args.ok()) return invalid;
+		if (auto e = bus.write_file_record(slave_id, groups, 1s).error()) return e;
 
 	} else if (std::strcmp(cmd, "mask-write-register") == 0) {
-		uint16_t address = parse_uint(next_arg());
-		uint16_t and_mask = parse_uint(next_arg());
-		uint16_t or_mask = parse_uint(next_arg());
-		check(bus.mask_write_register(slave_id, address, and_mask, or_mask, 1s));
+		uint16_t address = args.next_uint();
+		uint16_t and_mask = args.next_uint();
+		uint16_t or_mask = args.next_uint();
+		if (!args.ok()) return invalid;
+		if (auto e = bus.mask_write_register(slave_id, address, and_mask, or_mask, 1s).error()) return e;
 
 	} else if (std::strcmp(cmd, "read-write-registers") == 0) {
-		uint16_t read_address = parse_uint(next_arg());
-		std::vector<uint16_t> read_values(parse_uint(next_arg()));
-		uint16_t write_address = parse_uint(next_arg());
+		uint16_t read_address = args.next_uint();
+		std::vector<uint16_t> read_values(args.next_uint());
+		uint16_t write_address = args.next_uint();
 		std::vector<uint16_t> write_values;
-		while (char * a = *argv++) write_values.push_back(parse_uint(a));
-		check(bus.read_write_registers(slave_id, write_address, write_values, read_address, read_values, 1s));
+		while (!args.empty()) write_values.push_back(args.next_uint());
+		if (!args.ok()) return invalid;
+		if (auto e = bus.read_write_registers(slave_id, write_address, write_values, read_address, read_values, 1s).error()) return e;
 		show_regs(read_address, read_values);
 
+	} else if (std::strcmp(cmd, "read-fifo-queue") == 0) {
+		uint16_t address = args.next_uint();
+		std::vector<uint16_t> values(31);
+		if (!args.ok()) return invalid;
+		auto n = bus.read_fifo_queue(slave_id, address, values, 1s);
+		if (!n) return n.error();
+		for (size_t i = 0; i < *n; ++i) std::printf("%2zu: 0x%04X (%d)\n", i, values[i], values[i]);
+
+	} else {
+		args.fail("Invalid command.");
+		return invalid;
+
+	}
+
+	return {};
+}
+
+struct file_closer {
+	void operator()(std::FILE * f) { std::fclose(f); }
+};
+
+// Run the commands in a file (or stdin, for "-"), one per line, as
+// <slave-id> <command> [<argument>...]. Empty lines and lines starting with
+// # are skipped. Every command is echoed before its output. Stops at the
+// first failing command, unless keep_going is set. Ends with the status of
+// every command.
+int run_batch(::Modbus::Modbus & bus, char const * file_name, bool keep_going) {
+	std::unique_ptr<std::FILE, file_closer> file;
+	std::FILE * in = stdin;
+	if (std::strcmp(file_name, "-") != 0) {
+		file.reset(std::fopen(file_name, "r"));
+		if (!file) {
+			std::fprintf(stderr, "Unable to open \"%s\": %s\n", file_name, std::strerror(errno));
+			return 1;
+		}
+		in = file.get();
+	}
+
+	// Write the output in large blocks, also when stdout is a terminal.
+	static char output_buffer[1 << 16];
+	std::setvbuf(stdout, output_buffer, _IOFBF, sizeof(output_buffer));
+
+	struct status {
+		unsigned int line;
+		std::string command;
+		std::string error;
+	};
+	std::vector<status> results;
+	unsigned int failed = 0;
+
+	char line[4096];
+	unsigned int line_number = 0;
+	while (std::fgets(line, sizeof(line), in)) {
+		++line_number;
+		std::vector<char *> words;
+		for (char * w = std::strtok(line, " \t\r\n"); w; w = std::strtok(nullptr, " \t\r\n")) {
+			words.push_back(w);
+		}
+		if (words.empty() || words[0][0] == '#') continue;
+
+		std::string command;
+		for (char * w : words) command += (command.empty() ? "" : " ") + std::string(w);
+		std::printf("> %s\n", command.c_str());
+
+		words.push_back(nullptr);
+		Arguments args(words.data());
+		byte_t slave_id = args.next_uint();
+		char const * cmd = args.next();
+		std::error_code e;
+		if (args.ok()) e = run_command(bus, slave_id, cmd, args).error();
+
+		results.push_back({line_number, command, {}});
+		if (!args.ok()) results.back().error = args.error();
+		else if (e) results.back().error = error_message(e);
+		if (!results.back().error.empty()) {
+			std::printf("%s\n", results.back().error.c_str());
+			++failed;
+			if (!keep_going) break;
+		}
+	}
+
+	if (std::ferror(in)) {
+		std::fflush(stdout);
+		std::fprintf(stderr, "Unable to read \"%s\": %s\n", file_name, std::strerror(errno));
+		return 1;
+	}
+
+	std::puts("\nSummary:");
+	for (auto const & r : results) {
+		std::printf("%4u: %s: %s\n", r.line, r.command.c_str(), r.error.empty() ? "ok" : r.error.c_str());
+	}
+	std::printf("%zu commands, %u failed.\n", results.size(), failed);
+	std::fflush(stdout);
+	return failed ? 1 : 0;
+}
+
+// One command of the mix sent by run_bench, with its buffers.
+struct bench_op {
+	std::string command;
+	std::string name;
+	uint16_t address = 0;
+	std::vector<uint16_t> values;
+	uint16_t and_mask = 0;
+	uint16_t or_mask = 0;
+};
+
+error_or<void> run_bench_op(::Modbus::Modbus & bus, byte_t slave_id, bench_op & op) {
+	char const * cmd = op.name.c_str();
+	if (std::strcmp(cmd, "read-coils") == 0) return bus.read_coils(slave_id, op.address, op.values, 1s);
+	if (std::strcmp(cmd, "read-inputs") == 0) return bus.read_inputs(slave_id, op.address, op.values, 1s);
+	if (std::strcmp(cmd, "read-holding-registers") == 0) return bus.read_holding_registers(slave_id, op.address, op.values, 1s);
+	if (std::strcmp(cmd, "read-input-registers") == 0) return bus.read_input_registers(slave_id, op.address, op.values, 1s);
+	if (std::strcmp(cmd, "write-single-coil") == 0) return bus.write_single_coil(slave_id, op.address, op.values[0], 1s);
+	if (std::strcmp(cmd, "write-single-register") == 0) return bus.write_single_register(slave_id, op.address, op.values[0], 1s);
+	if (std::strcmp(cmd, "write-multiple-registers") == 0) return bus.write_multiple_registers(slave_id, op.address, op.values, 1s);
+	if (std::strcmp(cmd, "mask-write-register") == 0) return bus.mask_write_register(slave_id, op.address, op.and_mask, op.or_mask, 1s);
+	auto n = bus.read_fifo_queue(slave_id, op.address, op.values, 1s);
+	if (!n) return n.error();
+	return {};
+}
+
+// Parse one command of the bench mix, up to the next ";". Exits on errors.
+bench_op parse_bench_op(char * * & argv) {
+	bench_op op;
+	op.name = *argv++;
+	op.command = op.name;
+	std::vector<unsigned int> a;
+	while (*argv && std::strcmp(*argv, ";") != 0) {
+		op.command += " " + std::string(*argv);
+		a.push_back(parse_uint(*argv++));
+	}
+	if (*argv) ++argv;
+
+	auto expect = [&] (std::size_t min, std::size_t max) {
+		if (a.size() < min || a.size() > max) {
+			fprintf(stderr, "Wrong number of arguments for \"%s\".\n", op.command.c_str());
+			std::exit(1);
+		}
+	};
+
+	char const * cmd = op.name.c_str();
+	if (
+		std::strcmp(cmd, "read-coils") == 0 ||
+		std::strcmp(cmd, "read-inputs") == 0 ||
+		std::strcmp(cmd, "read-holding-registers") == 0 ||
+		std::strcmp(cmd, "read-input-registers") == 0
+	) {
+		expect(2, 2);
+		op.values.resize(a[1]);
+	} else if (std::strcmp(cmd, "write-single-coil") == 0 || std::strcmp(cmd, "write-single-register") == 0) {
+		expect(2, 2);
+		op.values.push_back(a[1]);
+	} else if (std::strcmp(cmd, "write-multiple-registers") == 0) {
+		expect(2, 124);
+		op.values.assign(a.begin() + 1, a.end());
+	} else if (std::strcmp(cmd, "mask-write-register") == 0) {
+		expect(3, 3);
+		op.and_mask = a[1];
+		op.or_mask = a[2];
+	} else if (std::strcmp(cmd, "read-fifo-queue") == 0) {
+		expect(1, 1);
+		op.values.resize(31);
 	} else {
-		fputs("Invalid command.\n", stderr);
+		fprintf(stderr, "Invalid bench command \"%s\".\n", cmd);
+		std::exit(1);
+	}
+	op.address = a[0];
+	return op;
+}
+
+// The results of running the mix at one rate.
+struct bench_step {
+	double offered_rate; // Zero for as fast as possible.
+	double seconds;
+	unsigned int transactions;
+	double throughput;
+	std::chrono::microseconds p50, p99, p999;
+	// Count per error, by category and value.
+	std::map<std::pair<std::string, int>, std::pair<std::string, unsigned int>> errors;
+	unsigned int n_errors;
+};
+
+std::chrono::microseconds percentile(std::vector<std::uint32_t> & v, double p) {
+	if (v.empty()) return {};
+	auto i = v.begin() + std::min(v.size() - 1, std::size_t(p * v.size()));
+	std::nth_element(v.begin(), i, v.end());
+	return std::chrono::microseconds(*i);
+}
+
+// Send the commands of the mix in turn, for the given duration, with the
+// requests evenly spaced at the given rate (or back to back, for rate 0).
+// The latency is the duration of the transaction itself. Since only one
+// transaction is in flight at a time, a target that can't keep up shows
+// as a throughput below the offered rate.
+bench_step run_bench_step(
+	::Modbus::Modbus & bus,
+	byte_t slave_id,
+	std::vector<bench_op> & mix,
+	double rate,
+	std::chrono::seconds duration
+) {
+	using clock = std::chrono::steady_clock;
+	bench_step step{};
+	step.offered_rate = rate;
+
+	std::vector<std::uint32_t> latencies;
+	latencies.reserve(rate > 0 ? std::size_t(rate * duration.count()) + 1 : 1 << 16);
+
+	auto start = clock::now();
+	auto end = start + duration;
+	auto now = start;
+	for (std::size_t i = 0; ; ++i) {
+		if (rate > 0) {
+			auto next = start + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(i / rate));
+			if (next >= end) break;
+			if (next > now) std::this_thread::sleep_until(next);
+		} else if (now >= end) {
+			break;
+		}
+
+		auto t0 = clock::now();
+		auto e = run_bench_op(bus, slave_id, mix[i % mix.size()]).error();
+		now = clock::now();
+		latencies.push_back(std::chrono::duration_cast<std::chrono::microseconds>(now - t0).count());
+		if (e) {
+			auto & n = step.errors[{e.category().name(), e.value()}];
+			n.first = e.message();
+			++n.second;
+			++step.n_errors;
+		}
+	}
+	now = clock::now();
+
+	step.seconds = std::chrono::duration<double>(std::max(now, end) - start).count();
+	step.transactions = latencies.size();
+	step.throughput = step.transactions / step.seconds;
+	step.p50 = percentile(latencies, 0.5);
+	step.p99 = percentile(latencies, 0.99);
+	step.p999 = percentile(latencies, 0.999);
+	return step;
+}
+
+// A step is saturated when the target didn't keep up with the offered rate,
+// or when its p99 latency doubled compared to the first step.
+bool saturated(bench_step const & step, bench_step const & first) {
+	if (step.offered_rate > 0 && step.throughput < 0.95 * step.offered_rate) return true;
+	return step.p99 > 2 * first.p99;
+}
+
+std::string json_string(std::string const & s) {
+	std::string r = "\"";
+	for (char c : s) {
+		if (c == '"' || c == '\\') r += '\\';
+		if (static_cast<unsigned char>(c) < 0x20) c = ' ';
+		r += c;
+	}
+	return r + "\"";
+}
+
+void print_bench_step(bench_step const & s) {
+	std::printf(
+		"{\"offered_rate\": %g, \"seconds\": %.3f, \"transactions\": %u, \"throughput\": %.3f, "
+		"\"p50_us\": %lld, \"p99_us\": %lld, \"p999_us\": %lld, \"errors\": %u, \"error_breakdown\": [",
+		s.offered_rate, s.seconds, s.transactions, s.throughput,
+		static_cast<long long>(s.p50.count()),
+		static_cast<long long>(s.p99.count()),
+		static_cast<long long>(s.p999.count()),
+		s.n_errors
+	);
+	bool first = true;
+	for (auto const & e : s.errors) {
+		std::printf(
+			"%s{\"category\": %s, \"code\": %d, \"message\": %s, \"count\": %u}",
+			first ? "" : ", ",
+			json_string(e.first.first).c_str(), e.first.second,
+			json_string(e.second.first).c_str(), e.second.second
+		);
+		first = false;
+	}
+	std::printf("]}");
+}
+
+// Measure the throughput and latency of a slave (or gateway) for a mix of
+// commands at increasing rates, and find the rate at which it saturates.
+// Progress goes to stderr, and the results to stdout, as a JSON object.
+int run_bench(::Modbus::Modbus & bus, char * * argv) {
+	auto duration = 5s;
+	std::vector<double> rates;
+	for (;;) {
+		if (*argv && std::strcmp(*argv, "-t") == 0 && argv[1]) {
+			duration = std::chrono::seconds(parse_uint(argv[1]));
+			argv += 2;
+		} else if (*argv && std::strcmp(*argv, "-r") == 0 && argv[1]) {
+			for (char * r = std::strtok(argv[1], ","); r; r = std::strtok(nullptr, ",")) rates.push_back(parse_uint(r));
+			argv += 2;
+		} else {
+			break;
+		}
+	}
+	if (!*argv || !argv[1]) {
+		fputs("Missing argument.\n", stderr);
 		std::exit(1);
+	}
+	byte_t slave_id = parse_uint(*argv++);
+	std::vector<bench_op> mix;
+	while (*argv) mix.push_back(parse_bench_op(argv));
+
+	bool ramp = rates.empty();
+	if (ramp) rates.push_back(10);
 
+	std::vector<bench_step> steps;
+	std::size_t saturation = 0; // Index of the first saturated step, plus one.
+	for (std::size_t i = 0; i < rates.size(); ++i) {
+		std::fprintf(stderr, "Rate %g/s...\n", rates[i]);
+		steps.push_back(run_bench_step(bus, slave_id, mix, rates[i], duration));
+		if (rates[i] > 0 && !saturation && saturated(steps.back(), steps.front())) saturation = steps.size();
+		if (ramp && !saturation && rates[i] < 1e6) rates.push_back(rates[i] * 2);
+	}
+	if (std::find(rates.begin(), rates.end(), 0) == rates.end()) {
+		std::fputs("Rate unlimited...\n", stderr);
+		steps.push_back(run_bench_step(bus, slave_id, mix, 0, duration));
+	}
+
+	std::printf("{\n\"slave_id\": %u,\n\"mix\": [", slave_id);
+	for (std::size_t i = 0; i < mix.size(); ++i) std::printf("%s%s", i ? ", " : "", json_string(mix[i].command).c_str());
+	std::printf("],\n\"step_seconds\": %lld,\n\"steps\": [\n", static_cast<long long>(duration.count()));
+	for (std::size_t i = 0; i < steps.size(); ++i) {
+		print_bench_step(steps[i]);
+		std::printf("%s\n", i + 1 < steps.size() ? "," : "");
+	}
+	std::printf("],\n\"saturation\": ");
+	if (saturation) print_bench_step(steps[saturation - 1]);
+	else std::printf("null");
+	double max_throughput = 0;
+	for (auto const & s : steps) max_throughput = std::max(max_throughput, s.throughput);
+	std::printf(",\n\"max_throughput\": %.3f\n}\n", max_throughput);
+	return 0;
+}
+
+// The file with the remembered serial settings of every port.
+std::string line_config_file() {
+	if (char const * f = std::getenv("MODBUS_LINES")) return f;
+	char const * home = std::getenv("HOME");
+	return std::string(home ? home : ".") + "/.modbus-lines";
+}
+
+void remember_lines(range<line_config const> detected) {
+	std::string file = line_config_file();
+	std::vector<line_config> lines;
+	if (auto r = load_line_configs(file.c_str())) lines = std::move(*r);
+	for (auto const & d : detected) {
+		lines.erase(std::remove_if(lines.begin(), lines.end(), [&] (line_config const & l) { return l.port == d.port; }), lines.end());
+		lines.push_back(d);
+	}
+	if (auto e = save_line_configs(file.c_str(), lines).error()) {
+		std::fprintf(stderr, "Unable to save \"%s\": %s\n", file.c_str(), error_message(e).c_str());
+	}
+}
+
+// For -s auto: use the remembered settings of the port if a slave still
+// answers with them, and detect them otherwise. Exits if detection fails.
+SerialSettings auto_configure(ModbusSerialRtu & bus, char const * port_name, int slave_id) {
+	autodetect_options options;
+	options.slave_ids.clear();
+	if (slave_id >= 0) options.slave_ids.push_back(slave_id);
+
+	if (auto lines = load_line_configs(line_config_file().c_str())) {
+		for (auto const & l : *lines) {
+			if (l.port != port_name) continue;
+			autodetect_options remembered = options;
+			remembered.candidates = {l.settings};
+			remembered.slave_ids.push_back(l.slave_id);
+			remembered.confirmations = 1;
+			if (autodetect(bus, remembered)) return l.settings;
+			options.slave_ids.push_back(l.slave_id);
+		}
+	}
+
+	if (options.slave_ids.empty()) options.slave_ids.push_back(1);
+	std::fprintf(stderr, "Detecting serial settings of %s...\n", port_name);
+	auto r = autodetect(bus, options);
+	if (!r) {
+		std::fprintf(stderr, "Unable to detect the serial settings of %s: %s\n", port_name, error_message(r.error()).c_str());
+		std::exit(1);
+	}
+	r->port = port_name;
+	std::fprintf(stderr, "Detected %s.\n", format_serial_settings(r->settings).c_str());
+	remember_lines(range<line_config const>(*r));
+	return r->settings;
+}
+
+// Detect the serial settings of all ports in parallel, and remember them.
+int run_detect(char * * argv) {
+	autodetect_options options;
+	if (*argv && std::strcmp(*argv, "-i") == 0 && argv[1]) {
+		options.slave_ids = {byte_t(parse_uint(argv[1]))};
+		argv += 2;
+	}
+	std::vector<std::string> ports;
+	while (*argv) ports.push_back(*argv++);
+	if (ports.empty()) {
+		fputs("Missing argument.\n", stderr);
+		std::exit(1);
+	}
+
+	auto results = autodetect_ports(ports, options);
+
+	std::vector<line_config> detected;
+	for (std::size_t i = 0; i < ports.size(); ++i) {
+		if (results[i]) {
+			std::printf("%s: %s, slave %u\n", ports[i].c_str(), format_serial_settings(results[i]->settings).c_str(), results[i]->slave_id);
+			detected.push_back(*results[i]);
+		} else {
+			std::printf("%s: %s\n", ports[i].c_str(), error_message(results[i].error()).c_str());
+		}
+	}
+	if (!detected.empty()) remember_lines(detected);
+	return detected.size() == ports.size() ? 0 : 1;
+}
+
+int main(int argc, char * * argv) {
+	char const * argv0 = argv[0];
+	++argv;
+
+	if (argc <= 1) {
+		puts("Modbus tool.");
+		usage(argv0);
+		return 0;
+	}
+
+	auto next_arg = [&] {
+		char * arg = *argv++;
+		if (!arg) {
+			fputs("Missing argument.\n", stderr);
+			std::exit(1);
+		}
+		return arg;
+	};
+
+	char const * port_name = next_arg();
+
+	if (std::strcmp(port_name, "detect") == 0) return run_detect(argv);
+
+	std::unique_ptr<::Modbus::Modbus> owned_bus;
+
+	// A short timeout for probing slaves that might not exist.
+	std::chrono::milliseconds quick_timeout = 100ms;
+
+#ifdef MODBUS_TOOL_SOCKET
+	bool tcp = std::strncmp(port_name, "tcp:", 4) == 0;
+	bool udp = std::strncmp(port_name, "udp:", 4) == 0;
+	if (tcp || udp) {
+		std::string host = port_name + 4;
+		auto colon = host.rfind(':');
+		if (colon == std::string::npos) {
+			fprintf(stderr, "Expected <host>:<port>, but got \"%s\".\n", host.c_str());
+			std::exit(1);
+		}
+		std::string service = host.substr(colon + 1);
+		host.resize(colon);
+		auto socket_bus = std::make_unique<ModbusRtuSocket>();
+		auto protocol = tcp ? ModbusRtuSocket::Protocol::tcp : ModbusRtuSocket::Protocol::udp;
+		check(socket_bus->connect(protocol, host.c_str(), service.c_str()));
+		owned_bus = std::move(socket_bus);
+	} else
+#endif
+	{
+		Port port;
+		check(port.open(port_name));
+
+		// Without -s, the port is left as it is, and assumed to use the Modbus
+		// default, 19200 8E1.
+		SerialSettings settings;
+		bool configure = false;
+		bool detect = false;
+
+		if (*argv && (*argv)[0] == '-' && (*argv)[1] == 's') {
+			char * a = next_arg() + 2;
+			if (*a == '\0') a = next_arg();
+			if (std::strcmp(a, "auto") == 0) {
+				detect = true;
+			} else if (auto s = parse_serial_settings(a)) {
+				configure = true;
+				settings = *s;
+			} else {
+				fprintf(stderr, "Expected serial settings (<baud-rate>[(N|E|O)[<stop-bits>]]), but got \"%s\".\n", a);
+				std::exit(1);
+			}
+		}
+
+#ifdef MODBUS_TOOL_RS485
+		if (*argv && std::strcmp(*argv, "-d") == 0) {
+			++argv;
+			check(enable_rs485(port_name));
+		}
+#endif
+
+		std::unique_ptr<ModbusSerial> serial_bus;
+
+		if (*argv && std::strcmp(*argv, "-a") == 0) {
+			++argv;
+			if (detect) {
+				fputs("Detecting the serial settings is only supported for RTU.\n", stderr);
+				std::exit(1);
+			}
+			settings.data_bits = DataBits::seven;
+			serial_bus = std::make_unique<ModbusSerialAscii>(std::move(port), settings);
+		} else {
+			auto rtu_bus = std::make_unique<ModbusSerialRtu>(std::move(port), settings);
+			if (*argv && std::strcmp(*argv, "-e") == 0) {
+				++argv;
+				rtu_bus->set_local_echo(true);
+			}
+			if (detect) {
+				// Probe the slave of the command, if it is given here.
+				int slave_id = -1;
+				if (*argv) {
+					char * end;
+					long id = std::strtol(*argv, &end, 0);
+					if (end != *argv && *end == '\0' && id >= 0 && id < 256) slave_id = id;
+				}
+				settings = auto_configure(*rtu_bus, port_name, slave_id);
+			}
+			serial_bus = std::move(rtu_bus);
+		}
+
+		if (configure) check(serial_bus->configure(settings));
+
+		quick_timeout = settings.first_byte_timeout(8, 20ms);
+
+		owned_bus = std::move(serial_bus);
+	}
+
+	// With -c, requests are checked against a capability cache before they
+	// are sent, and what is learned from the responses is saved to it.
+	char const * cache_file = nullptr;
+	CapabilityCache cache;
+	if (*argv && std::strcmp(*argv, "-c") == 0) {
+		++argv;
+		cache_file = next_arg();
+		auto e = cache.load(cache_file).error();
+		if (e && e != std::errc::no_such_file_or_directory) check(e);
+	}
+
+	ModbusCapabilityGuard guard(*owned_bus, cache);
+
+	::Modbus::Modbus & bus = cache_file ? static_cast<::Modbus::Modbus &>(guard) : *owned_bus;
+
+	// Keep what was learned, also when a command failed.
+	auto save_cache = [&] {
+		if (cache_file && cache.changed()) check(cache.save(cache_file));
+	};
+
+	if (*argv && std::strcmp(*argv, "scan") == 0) {
+		++argv;
+		byte_t first = 1;
+		byte_t last = 247;
+		char const * output = nullptr;
+		if (*argv && std::strcmp(*argv, "-o") != 0) {
+			first = parse_uint(next_arg());
+			last = parse_uint(next_arg());
+		}
+		if (*argv && std::strcmp(*argv, "-o") == 0) {
+			++argv;
+			output = next_arg();
+		}
+		if (cache_file) {
+			fputs("Use -o to save the results of a scan.\n", stderr);
+			std::exit(1);
+		}
+		auto rtu_bus = dynamic_cast<ModbusSerialRtu *>(&bus);
+		for (byte_t id : scan(bus, first, last, quick_timeout)) {
+			DeviceProfile p = probe(bus, id, quick_timeout);
+			if (rtu_bus) {
+				if (auto echo = rtu_bus->detect_echo(id, quick_timeout)) {
+					p.echo = *echo ? DeviceProfile::Echo::local : DeviceProfile::Echo::none;
+				}
+			}
+			cache.set(p);
+			std::printf("%3u: functions", id);
+			for (unsigned int f = 0; f < 128; ++f) if (p.supports(f)) std::printf(" 0x%02X", f);
+			std::printf(", max %u registers, max %u coils", p.max_read_registers, p.max_read_coils);
+			if (p.echo != DeviceProfile::Echo::unknown) std::printf(", %s echo", p.echo == DeviceProfile::Echo::local ? "local" : "no");
+			std::printf("\n");
+		}
+		if (output) check(cache.save(output));
+		return 0;
+	}
+
+	if (*argv && std::strcmp(*argv, "batch") == 0) {
+		++argv;
+		bool keep_going = false;
+		if (*argv && std::strcmp(*argv, "-k") == 0) {
+			++argv;
+			keep_going = true;
+		}
+		int r = run_batch(bus, *argv ? *argv : "-", keep_going);
+		save_cache();
+		return r;
+	}
+
+	if (*argv && std::strcmp(*argv, "bench") == 0) {
+		int r = run_bench(bus, argv + 1);
+		save_cache();
+		return r;
+	}
+
+	uint8_t slave_id = parse_uint(next_arg());
+
+	char const * cmd = next_arg();
+
+	Arguments args(argv);
+	auto result = run_command(bus, slave_id, cmd, args);
+	save_cache();
+	if (!args.ok()) {
+		fprintf(stderr, "%s\n", args.error().c_str());
+		std::exit(1);
 	}
+	check(result);
 }